@@ -0,0 +1,13 @@
+// CPU use, as cpustat() reports it. Times are in ticks of the
+// time register, 100ns on qemu.
+struct cpustat {
+  int nice;           // -20 (most CPU) to 19 (least)
+  uint64 utime;       // in user space
+  uint64 stime;       // in the kernel
+  uint64 vruntime;    // CPU time scaled by weight, as the scheduler sees it
+  uint64 nvcsw;       // times it gave up the CPU to sleep
+  uint64 nivcsw;      // and was preempted
+  uint64 cpumask;     // harts it may run on
+  int lastcpu;        // hart it last ran on, or -1
+  uint64 nmigrate;    // times it ran on another hart than last
+};
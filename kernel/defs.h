@@ -1,7 +1,13 @@
 struct buf;
+struct page;
 struct context;
+struct cpustat;
 struct file;
+struct hrtimer;
 struct inode;
+struct memstat;
+struct memuse;
+struct wsinfo;
 struct pipe;
 struct proc;
 struct spinlock;
@@ -21,6 +27,15 @@ void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
 
+// pcache.c
+void            pinit(void);
+struct page*    pread(struct inode*, uint);
+void            prelse(struct page*);
+void            pwrite(struct inode*, uint, char*, uint);
+void            pinval(struct inode*, uint, uint);
+void            pinvalall(struct inode*);
+int             pcachepages(void);
+
 // console.c
 void            consoleinit(void);
 void            consoleintr(int);
@@ -28,6 +43,9 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execproc(struct proc*, char*, char**);
+int             intext(struct proc*, uint64);
+int             textfault(struct proc*, uint64);
 
 // file.c
 struct file*    filealloc(void);
@@ -37,6 +55,16 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+void            fdinit(struct proc*);
+int             fdalloc(struct file*);
+struct file*    fdget(struct proc*, int);
+struct file*    fdclear(struct proc*, int);
+struct file*    fdhold(int);
+void            fdunhold(struct proc*);
+int             fdcopy(struct proc*, struct proc*);
+void            fdspawn(struct proc*, struct proc*, int*, int);
+void            fdcloseall(struct proc*);
+void            fdfreetable(struct proc*);
 
 // fs.c
 void            fsinit(int);
@@ -49,11 +77,14 @@ void            ilock(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
+void            ilockshared(struct inode*);
+void            iunlockshared(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+int             ireadblocks(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
@@ -71,6 +102,9 @@ uint64          kfreemem(void);
 void            incmapcount(void *, int);
 void            decmapcount(void *);
 int             getmapcount(void *); 
+int             kdropref(void *);
+int             ktotalpages(void);
+int             ksharedpages(void);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -89,11 +123,21 @@ void            printf(char*, ...);
 void            panic(char*) __attribute__((noreturn));
 void            printfinit(void);
 void            backtrace(void);
+int             tracefrom(uint64, uint64*, int);
+int             trace(uint64*, int);
 
 // proc.c
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             clone(uint64, uint64, uint64);
+struct proc*    leaderof(struct proc*);
+int             threaded(struct proc*);
+int             pagetableidle(struct proc*);
+void            killthreads(struct proc*);
+int             vmlock(struct proc*, int);
+void            vmunlock(struct proc*);
+int             spawn(char*, char**, int*, int);
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
@@ -116,6 +160,10 @@ int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
 int             procnums(void);
+int             procmemuse(int, struct memuse*, struct wsinfo*);
+int             proccpustat(int, struct cpustat*);
+int             setnice(int, int);
+int             setaffinity(int, uint64);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -128,10 +176,23 @@ void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
+// lockstat.c
+int             lockacquired(char*, uint64, int, uint64, int);
+void            lockreleased(int, uint64);
+void            lockstatreset(void);
+void            lockstatinithart(void);
+int             statslockstat(char*, int);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
+int             tryacquiresleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
+void            acquiresleepshared(struct sleeplock*);
+void            releasesleepshared(struct sleeplock*);
+void            downgradesleep(struct sleeplock*);
+int             holdingsleepshared(struct sleeplock*);
+int             statssleep(char*, int);
 void            initsleeplock(struct sleeplock*, char*);
 
 // string.c
@@ -153,6 +214,7 @@ void            syscall();
 
 // trap.c
 extern uint     ticks;
+void            clockupdate(void);
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
@@ -168,6 +230,15 @@ int             uartgetc(void);
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+uint64          uvmactivate(struct proc*);
+void            uvmsfence(pagetable_t, uint64);
+void            uvmsfenceall(pagetable_t);
+void            tlbservice(void);
+void            uvmprefault(uint64, uint64, int);
+int             usertrace(pagetable_t, uint64, uint64*, int);
+uint64          userwordaddr(pagetable_t, uint64);
+void*           uvmzeropage(void);
+int             uvmlazy(pagetable_t, uint64, int);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
@@ -176,15 +247,59 @@ uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
+void            uvmcount(pagetable_t, struct memuse*, int);
+int             ptpages(void);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
+pte_t *         walknext(pagetable_t, uint64*, uint64);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 void            vmprint(pagetable_t);
-int             pagefault(pagetable_t, uint64);
+int             pagefault(pagetable_t, uint64, int);
+#define FAULT_READ  0   // pagefault() access types; a boolean
+#define FAULT_WRITE 1   // "write" serves as one.
+#define FAULT_EXEC  2
+
+// swap.c
+void            swapinit(void);
+uint64          swapspace(void);
+void            swapdup(uint);
+void            swapfree(uint);
+int             swapreclaim(int);
+void            swapreserve(void);
+int             swapin(pagetable_t, uint64, pte_t*);
+void            swapusage(struct memstat*);
+int             statsswap(char*, int);
+
+// ksm.c
+void            ksminit(void);
+void            ksmidle(void);
+int             ksmpages(void);
+int             statsksm(char*, int);
+
+// wss.c
+void            wssinit(void);
+void            wsssample(void);
+int             wssreferenced(pte_t*);
+int             statswss(char*, int);
+
+// lz4.c
+int             lz4compress(uchar*, int, uchar*, int);
+int             lz4decompress(uchar*, int, uchar*, int);
+
+// vma.c
+struct vma;
+void            vmainit(struct proc*);
+void            vmafreetable(struct proc*);
+struct vma*     vmalookup(struct proc*, uint64);
+uint64          vmamap(struct proc*, uint64, uint64, int, int, struct file*, uint);
+int             vmaunmap(struct proc*, uint64, uint64);
+int             vmadiscard(struct proc*, uint64, uint64);
+void            vmacloseall(struct proc*);
+int             vmacopy(struct proc*, struct proc*);
 
 // plic.c
 void            plicinit(void);
@@ -222,6 +337,31 @@ int             sockwrite(struct sock *, uint64, int);
 void            sockrecvudp(struct mbuf*, uint32, uint16, uint16);
 #endif
 
+// prof.c
+void            profinit(void);
+int             proftick(void);
+void            profsample(int, uint64, uint64);
+int             statsprof(char*, int);
+
+// futex.c
+void            futexinit(void);
+int             futexwait(uint64, uint, uint64);
+int             futexwake(uint64, int);
+
+// hrtimer.c
+void            hrinit(void);
+void            hrstart(struct hrtimer*, uint64);
+int             hrcancel(struct hrtimer*);
+int             hrintr(void);
+void            hrtick(int);
+void            hrinterval(uint64);
+int             hrsleep(uint64);
+
+// systrace.c
+void            systraceinit(void);
+void            systrace(int, uint64*, uint64, uint64);
+int             statssystrace(char*, int);
+
 // stats.c
 void            statsinit(void);
 void            statsinc(void);
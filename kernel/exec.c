@@ -6,6 +6,10 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "page.h"
 
 static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
 
@@ -19,17 +23,21 @@ int flags2perm(int flags)
     return perm;
 }
 
+// Replace p's user memory with the program at path, run with
+// argv. p is the current process, or a new one that spawn() has
+// not yet made runnable. Returns argc, or -1 leaving p as it was.
 int
-exec(char *path, char **argv)
+execproc(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
   int i, off;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *textip = 0, *oldtextip;
   struct proghdr ph;
+  struct textseg textseg[NTEXTSEG];
+  int ntextseg = 0;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
 
   begin_op();
 
@@ -62,17 +70,34 @@ exec(char *path, char **argv)
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
     uint64 sz1;
+    uint lazy = 0;
+    if((ph.flags & ELF_PROG_FLAG_WRITE) == 0 && ph.off % PGSIZE == 0 &&
+       ph.filesz >= PGSIZE && ntextseg < NTEXTSEG){
+      // Read-only segment: leave its whole pages unmapped, for
+      // textfault() to map from the page cache, shared with every
+      // other process running this program. The partial last page
+      // is loaded now, so that nothing past filesz leaks in.
+      lazy = PGROUNDDOWN(ph.filesz);
+      textseg[ntextseg].va = ph.vaddr;
+      textseg[ntextseg].end = ph.vaddr + lazy;
+      textseg[ntextseg].off = ph.off;
+      textseg[ntextseg].perm = PTE_R|PTE_U|flags2perm(ph.flags);
+      ntextseg++;
+      if(ph.vaddr + lazy > sz)
+        sz = ph.vaddr + lazy;
+    }
     if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
       goto bad;
     sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(loadseg(pagetable, ph.vaddr + lazy, ip, ph.off + lazy, ph.filesz - lazy) < 0)
       goto bad;
   }
+  if(ntextseg > 0)
+    textip = idup(ip);
   iunlockput(ip);
   end_op();
   ip = 0;
 
-  p = myproc();
   uint64 oldsz = p->sz;
 
   // Allocate two pages at the next page boundary.
@@ -120,13 +145,27 @@ exec(char *path, char **argv)
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
     
-  // Commit to the user image.
+  // Commit to the user image, once any other threads have
+  // left the old one.
+  killthreads(p);
+  vmacloseall(p);
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
+  p->asid = 0;  // the old ASID's TLB entries are for oldpagetable.
   p->sz = sz;
+  uvmcount(pagetable, &p->mem, 1);
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
+  oldtextip = p->textip;
+  p->textip = textip;
+  memmove(p->textseg, textseg, sizeof(textseg));
+  p->ntextseg = ntextseg;
   proc_freepagetable(oldpagetable, oldsz);
+  if(oldtextip){
+    begin_op();
+    iput(oldtextip);
+    end_op();
+  }
 
   if (p->pid == 1) {
     vmprint(p->pagetable);
@@ -140,9 +179,77 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(textip){
+    begin_op();
+    iput(textip);
+    end_op();
+  }
   return -1;
 }
 
+// Is va in program text that exec() left to be paged in on demand?
+int
+intext(struct proc *p, uint64 va)
+{
+  struct textseg *ts;
+
+  for(ts = p->textseg; ts < &p->textseg[p->ntextseg]; ts++){
+    if(va >= ts->va && va < ts->end)
+      return 1;
+  }
+  return 0;
+}
+
+// Map the page of p's program text containing va from the page
+// cache, if exec() left it to be paged in on demand. If the cache
+// is out of memory, map a private copy.
+// Returns 0 on success, -1 if va is not demand-paged text.
+int
+textfault(struct proc *p, uint64 va)
+{
+  struct textseg *ts;
+  struct page *pg;
+  char *pa = 0;
+  uint off;
+
+  for(ts = p->textseg; ts < &p->textseg[p->ntextseg]; ts++){
+    if(va >= ts->va && va < ts->end)
+      break;
+  }
+  if(ts == &p->textseg[p->ntextseg])
+    return -1;
+
+  va = PGROUNDDOWN(va);
+  ilockshared(p->textip);
+  off = ts->off + va - ts->va;
+  if((pg = pread(p->textip, off / PGSIZE)) != 0){
+    pa = pg->data;
+    incmapcount(pa, 1);
+    prelse(pg);
+  } else if((pa = kalloc()) != 0){
+    memset(pa, 0, PGSIZE);
+    ireadblocks(p->textip, pa, off, PGSIZE);
+  }
+  iunlockshared(p->textip);
+  if(pa == 0)
+    return -1;
+
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)pa, ts->perm) != 0){
+    kfree(pa);
+    return -1;
+  }
+  return 0;
+}
+
+int
+exec(char *path, char **argv)
+{
+  // a thread's memory is its leader's to replace.
+  if(myproc()->leader)
+    return -1;
+  return execproc(myproc(), path, argv);
+}
+
 // Load a program segment into pagetable at virtual address va.
 // va must be page-aligned
 // and the pages from va to va+sz must already be mapped.
@@ -14,15 +14,46 @@
 #include "proc.h"
 
 struct devsw devsw[NDEV];
+
+// Open file structures. The first NFILE are static; when they
+// run out, filealloc() carves further ones out of whole pages.
+// Free structures are kept on a list so allocation is O(1).
 struct {
   struct spinlock lock;
   struct file file[NFILE];
+  struct file *freelist;
+  int nfile;            // number of file structures, free or not
 } ftable;
 
 void
 fileinit(void)
 {
+  struct file *f;
+
   initlock(&ftable.lock, "ftable");
+  for(f = ftable.file; f < ftable.file + NFILE; f++){
+    f->next = ftable.freelist;
+    ftable.freelist = f;
+  }
+  ftable.nfile = NFILE;
+}
+
+// Add a page worth of file structures to the free list.
+// Caller must hold ftable.lock.
+static int
+filegrow(void)
+{
+  struct file *f, *fs;
+
+  if((fs = (struct file*)kalloc()) == 0)
+    return -1;
+  memset(fs, 0, PGSIZE);
+  for(f = fs; f < fs + PGSIZE/sizeof(struct file); f++){
+    f->next = ftable.freelist;
+    ftable.freelist = f;
+    ftable.nfile++;
+  }
+  return 0;
 }
 
 // Allocate a file structure.
@@ -32,15 +63,16 @@ filealloc(void)
   struct file *f;
 
   acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
+  if(ftable.freelist == 0 && filegrow() < 0){
+    release(&ftable.lock);
+    return 0;
   }
+  f = ftable.freelist;
+  ftable.freelist = f->next;
+  f->next = 0;
+  f->ref = 1;
   release(&ftable.lock);
-  return 0;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -71,6 +103,8 @@ fileclose(struct file *f)
   ff = *f;
   f->ref = 0;
   f->type = FD_NONE;
+  f->next = ftable.freelist;
+  ftable.freelist = f;
   release(&ftable.lock);
 
   if(ff.type == FD_PIPE){
@@ -96,9 +130,9 @@ filestat(struct file *f, uint64 addr)
   struct stat st;
   // printf("filestate inum=%d\n", f->ip->inum);
   if(f->type == FD_INODE || f->type == FD_DEVICE){
-    ilock(f->ip);
+    ilockshared(f->ip);
     stati(f->ip, &st);
-    iunlock(f->ip);
+    iunlockshared(f->ip);
     if(copyout(p->pagetable, addr, (char *)&st, sizeof(st)) < 0)
       return -1;
     return 0;
@@ -116,6 +150,10 @@ fileread(struct file *f, uint64 addr, int n)
   if(f->readable == 0)
     return -1;
 
+  // the copy to addr is made under the inode's, the pipe's or the
+  // device's lock.
+  uvmprefault(addr, n, 1);
+
   if(f->type == FD_PIPE){
     r = piperead(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
@@ -123,10 +161,19 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    // readers share the inode's lock, unless f is shared too,
+    // whose offset the lock then has to keep to one of them.
+    if(f->ref > 1){
+      ilock(f->ip);
+      if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+        f->off += r;
+      iunlock(f->ip);
+    } else {
+      ilockshared(f->ip);
+      if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+        f->off += r;
+      iunlockshared(f->ip);
+    }
   }
 #ifdef LAB_NET
   else if(f->type == FD_SOCK){
@@ -150,6 +197,8 @@ filewrite(struct file *f, uint64 addr, int n)
   if(f->writable == 0)
     return -1;
 
+  uvmprefault(addr, n, 0);
+
   if(f->type == FD_PIPE){
     ret = pipewrite(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
@@ -195,4 +244,209 @@ filewrite(struct file *f, uint64 addr, int n)
   }
 
   return ret;
-}
\ No newline at end of file
+}
+
+// Per-process file descriptor tables.
+//
+// A process starts out with the NOFILE slots embedded in its
+// struct proc; the first time those fill up the table moves to
+// a page of its own, holding NOFILEMAX descriptors. p->fdmap
+// has a bit set for each descriptor in use, and p->fdfree is a
+// hint below which every descriptor is known to be in use, so
+// finding the lowest free descriptor only looks at a few words.
+//
+// Threads use their leader's table, under its p->fdlock.
+
+// Initialize an empty descriptor table for p.
+void
+fdinit(struct proc *p)
+{
+  p->ofile = p->ofile0;
+  p->nofile = NOFILE;
+  p->fdfree = 0;
+  memset(p->ofile0, 0, sizeof(p->ofile0));
+  memset(p->fdmap, 0, sizeof(p->fdmap));
+}
+
+// Move p's descriptors to a table with room for NOFILEMAX.
+static int
+fdgrow(struct proc *p)
+{
+  struct file **ofile;
+
+  if(p->nofile >= NOFILEMAX)
+    return -1;
+  if((ofile = (struct file**)kalloc()) == 0)
+    return -1;
+  memset(ofile, 0, PGSIZE);
+  memmove(ofile, p->ofile, p->nofile * sizeof(struct file*));
+  p->ofile = ofile;
+  p->nofile = NOFILEMAX;
+  return 0;
+}
+
+// Release the page holding p's descriptor table, if any.
+// All descriptors must already be closed.
+void
+fdfreetable(struct proc *p)
+{
+  if(p->ofile && p->ofile != p->ofile0)
+    kfree((void*)p->ofile);
+  p->ofile = p->ofile0;
+  p->nofile = NOFILE;
+}
+
+// Install f at descriptor fd of p.
+// Caller holds p->fdlock, or p is new.
+static void
+fdinstall(struct proc *p, int fd, struct file *f)
+{
+  p->ofile[fd] = f;
+  p->fdmap[fd/64] |= 1L << (fd%64);
+  if(fd == p->fdfree)
+    p->fdfree = fd + 1;
+}
+
+// Allocate the lowest free file descriptor of the current
+// process for f. Takes over file reference from caller on success.
+int
+fdalloc(struct file *f)
+{
+  struct proc *p = leaderof(myproc());
+  uint64 free;
+  int i, fd;
+
+  acquire(&p->fdlock);
+  for(i = p->fdfree/64; i < NOFILEMAX/64; i++){
+    if((free = ~p->fdmap[i]) == 0)
+      continue;
+    for(fd = i*64; (free & 1) == 0; free >>= 1)
+      fd++;
+    if(fd >= p->nofile && fdgrow(p) < 0)
+      break;
+    fdinstall(p, fd, f);
+    p->fdfree = fd + 1;
+    release(&p->fdlock);
+    return fd;
+  }
+  release(&p->fdlock);
+  return -1;
+}
+
+// Return the open file at descriptor fd of p, or 0.
+struct file*
+fdget(struct proc *p, int fd)
+{
+  struct file *f = 0;
+
+  p = leaderof(p);
+  acquire(&p->fdlock);
+  if(fd >= 0 && fd < p->nofile)
+    f = p->ofile[fd];
+  release(&p->fdlock);
+  return f;
+}
+
+// Return the current process's open file at descriptor fd, or 0,
+// for the current system call, which may use one. If threads
+// share the table, another could close fd meanwhile, so the call
+// holds a reference of its own until syscall() calls fdunhold().
+struct file*
+fdhold(int fd)
+{
+  struct proc *p = myproc();
+  struct proc *mp = leaderof(p);
+  struct file *f = 0;
+
+  if(!threaded(p))
+    return fdget(p, fd);
+  acquire(&mp->fdlock);
+  if(fd >= 0 && fd < mp->nofile && mp->ofile[fd])
+    f = p->fdheld = filedup(mp->ofile[fd]);
+  release(&mp->fdlock);
+  return f;
+}
+
+// Drop the reference fdhold() took for p's system call, if any.
+void
+fdunhold(struct proc *p)
+{
+  if(p->fdheld){
+    fileclose(p->fdheld);
+    p->fdheld = 0;
+  }
+}
+
+// Clear descriptor fd of p. Does not close the file, but
+// returns it, or 0 if fd was not open.
+struct file*
+fdclear(struct proc *p, int fd)
+{
+  struct file *f = 0;
+
+  p = leaderof(p);
+  acquire(&p->fdlock);
+  if(fd >= 0 && fd < p->nofile){
+    f = p->ofile[fd];
+    p->ofile[fd] = 0;
+    p->fdmap[fd/64] &= ~(1L << (fd%64));
+    if(fd < p->fdfree)
+      p->fdfree = fd;
+  }
+  release(&p->fdlock);
+  return f;
+}
+
+// Give np a copy of p's descriptor table, for fork().
+// Returns 0 on success, -1 if the table could not be grown.
+int
+fdcopy(struct proc *np, struct proc *p)
+{
+  int fd;
+
+  p = leaderof(p);
+  acquire(&p->fdlock);
+  if(p->nofile > np->nofile && fdgrow(np) < 0){
+    release(&p->fdlock);
+    return -1;
+  }
+  for(fd = 0; fd < p->nofile; fd++)
+    if(p->ofile[fd])
+      fdinstall(np, fd, filedup(p->ofile[fd]));
+  np->fdfree = p->fdfree;
+  release(&p->fdlock);
+  return 0;
+}
+
+// Give np descriptors 0..n-1 that are dups of p's descriptors
+// fds[0..n-1], or closed where fds[i] is negative, for spawn().
+// The caller has checked that the fds are open and n <= NOFILE.
+void
+fdspawn(struct proc *np, struct proc *p, int *fds, int n)
+{
+  int fd;
+
+  p = leaderof(p);
+  acquire(&p->fdlock);
+  for(fd = 0; fd < n; fd++)
+    if(fds[fd] >= 0 && fds[fd] < p->nofile && p->ofile[fds[fd]])
+      fdinstall(np, fd, filedup(p->ofile[fds[fd]]));
+  release(&p->fdlock);
+}
+
+// Close every open descriptor of p, for exit(), once p has no
+// threads.
+void
+fdcloseall(struct proc *p)
+{
+  struct file *f;
+  int fd;
+
+  for(fd = 0; fd < p->nofile; fd++){
+    if((f = p->ofile[fd]) != 0){
+      fdclear(p, fd);
+      fileclose(f);
+    }
+  }
+  fdfreetable(p);
+}
@@ -5,6 +5,7 @@ struct file {
   enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE } type;
 #endif
   int ref; // reference count
+  struct file *next; // ftable free list
   char readable;
   char writable;
   struct pipe *pipe; // FD_PIPE
@@ -46,3 +47,5 @@ extern struct devsw devsw[];
 
 #define CONSOLE 1
 #define STATS   2
+#define PROF    3
+#define SYSTRACE 4
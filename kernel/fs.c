@@ -20,6 +20,7 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "page.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 // there should be one superblock per disk device, but we run with
@@ -144,7 +145,9 @@ bfree(int dev, uint b)
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
-//   has first locked the inode.
+//   has first locked the inode. Code that only examines
+//   them, like read() and path lookup, may lock it shared
+//   with ilockshared(), alongside other such code.
 //
 // Thus a typical sequence is:
 //   ip = iget(dev, inum)
@@ -327,6 +330,32 @@ iunlock(struct inode *ip)
   releasesleep(&ip->lock);
 }
 
+// Lock the given inode shared, to examine but not modify it
+// or its content.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  acquiresleepshared(&ip->lock);
+  if(ip->valid == 0){
+    // reading it in modifies it.
+    releasesleepshared(&ip->lock);
+    ilock(ip);
+    downgradesleep(&ip->lock);
+  }
+}
+
+void
+iunlockshared(struct inode *ip)
+{
+  if(ip == 0 || !holdingsleepshared(&ip->lock) || ip->ref < 1)
+    panic("iunlockshared");
+
+  releasesleepshared(&ip->lock);
+}
+
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode table entry can
 // be recycled.
@@ -509,6 +538,7 @@ itrunc(struct inode *ip)
 
   ip->size = 0;
   iupdate(ip);
+  pinvalall(ip);
 }
 
 // Copy stat information from inode.
@@ -523,12 +553,12 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
-// Read data from inode.
+// Read n bytes at off of ip's contents into kernel memory
+// at dst, straight from the disk blocks. Used by the page cache
+// to fill pages; everyone else should call readi().
 // Caller must hold ip->lock.
-// If user_dst==1, then dst is a user virtual address;
-// otherwise, dst is a kernel address.
 int
-readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+ireadblocks(struct inode *ip, char *dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
@@ -544,12 +574,51 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
       break;
     bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
+    memmove(dst, bp->data + (off % BSIZE), m);
+    brelse(bp);
+  }
+  return tot;
+}
+
+// Read data from inode, through the page cache.
+// Caller must hold ip->lock, shared or not.
+// If user_dst==1, then dst is a user virtual address;
+// otherwise, dst is a kernel address.
+int
+readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  uint tot, m;
+  struct page *pg;
+  struct buf *bp;
+
+  if(off > ip->size || off + n < off)
+    return 0;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    if((pg = pread(ip, off/PGSIZE)) == 0){
+      // the cache is out of memory: read this block around it.
+      uint addr = bmap(ip, off/BSIZE);
+      if(addr == 0)
+        break;
+      bp = bread(ip->dev, addr);
+      m = min(n - tot, BSIZE - off%BSIZE);
+      if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
+        brelse(bp);
+        tot = -1;
+        break;
+      }
       brelse(bp);
+      continue;
+    }
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    if(either_copyout(user_dst, dst, pg->data + (off % PGSIZE), m) == -1) {
+      prelse(pg);
       tot = -1;
       break;
     }
-    brelse(bp);
+    prelse(pg);
   }
   return tot;
 }
@@ -583,6 +652,8 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       break;
     }
     log_write(bp);
+    // keep the page cache, and so mmap()ed pages, up to date.
+    pwrite(ip, off, (char*)bp->data + (off % BSIZE), m);
     brelse(bp);
   }
 
@@ -718,21 +789,22 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    ilockshared(ip);
     if(ip->type != T_DIR){
-      iunlockput(ip);
+      iunlockshared(ip);
+      iput(ip);
       return 0;
     }
     if(nameiparent && *path == '\0'){
       // Stop one level early.
-      iunlock(ip);
+      iunlockshared(ip);
       return ip;
     }
-    if((next = dirlookup(ip, name, 0)) == 0){
-      iunlockput(ip);
+    next = dirlookup(ip, name, 0);
+    iunlockshared(ip);
+    iput(ip);
+    if(next == 0)
       return 0;
-    }
-    iunlockput(ip);
     ip = next;
   }
   if(nameiparent){
@@ -0,0 +1,170 @@
+// Futexes: blocking on a word of user memory.
+//
+// futex_wait(addr, val, timeout) sleeps if the 32-bit word at addr
+// still holds val, until futex_wake(addr, n) on the same word, or
+// for at most timeout nanoseconds if that is not 0. Waiters are
+// keyed by the physical address of the word, so processes that map
+// the same page, as threads do and MAP_SHARED mappings do, wait on
+// and wake each other through their own addresses for it. The
+// waiters hang off NFUTEXHASH buckets by key, each with a lock.
+//
+// futex_wait compares the word with the bucket locked, and a waker
+// stores to the word before it locks the bucket, so a wakeup that
+// follows a change to the word cannot be missed.
+//
+// The key is taken when the call is made. Pages that waiters share
+// stay put: swap and same-page merging leave alone the pages of
+// processes with threads, and pages that more than one process
+// maps. user/usync.c builds mutexes and condition variables on
+// these calls.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "hrtimer.h"
+#include "defs.h"
+
+#define NFUTEXHASH 64
+
+struct waiter {
+  uint64 key;           // physical address of the word
+  int state;            // WAITING, WOKEN or TIMEDOUT
+  int timing;           // the timer may still fire
+  struct bucket *b;
+  struct waiter *next;
+};
+
+enum { WAITING, WOKEN, TIMEDOUT };
+
+static struct bucket {
+  struct spinlock lock;
+  struct waiter *head;
+} futex[NFUTEXHASH];
+
+static struct bucket*
+bucketof(uint64 key)
+{
+  return &futex[(key >> 2) % NFUTEXHASH];
+}
+
+// Take w off its bucket's list, and mark it state.
+// w->b->lock must be held.
+static void
+dequeue(struct waiter *w, int state)
+{
+  struct waiter **wp;
+
+  for(wp = &w->b->head; *wp; wp = &(*wp)->next){
+    if(*wp == w){
+      *wp = w->next;
+      break;
+    }
+  }
+  w->state = state;
+}
+
+static void
+timeout(struct hrtimer *t)
+{
+  struct waiter *w = t->arg;
+  struct bucket *b = w->b;
+
+  acquire(&b->lock);
+  if(w->state == WAITING)
+    dequeue(w, TIMEDOUT);
+  w->timing = 0;
+  wakeup(w);
+  release(&b->lock);
+}
+
+// Returns 0 if woken or if the word did not hold val, 1 if the
+// timeout ran out, or -1 if addr is bad or the process was killed.
+int
+futexwait(uint64 addr, uint val, uint64 ns)
+{
+  struct proc *p = myproc();
+  struct waiter w;
+  struct hrtimer t;
+  struct bucket *b;
+  int r = 0;
+
+  if(addr % sizeof(uint) != 0 || (w.key = userwordaddr(p->pagetable, addr)) == 0)
+    return -1;
+  b = w.b = bucketof(w.key);
+
+  acquire(&b->lock);
+  if(__atomic_load_n((uint*)w.key, __ATOMIC_SEQ_CST) != val){
+    release(&b->lock);
+    return 0;
+  }
+  w.state = WAITING;
+  w.next = b->head;
+  b->head = &w;
+  w.timing = 0;
+  if(ns){
+    t.fn = timeout;
+    t.arg = &w;
+    w.timing = 1;
+    hrstart(&t, r_time() + (ns + NSPERTIME - 1) / NSPERTIME);
+  }
+
+  while(w.state == WAITING){
+    if(killed(p)){
+      dequeue(&w, WOKEN);
+      r = -1;
+      break;
+    }
+    sleep(&w, &b->lock);
+  }
+  if(w.state == TIMEDOUT)
+    r = 1;
+
+  // the timer is on the stack: it must not fire once we return.
+  if(w.timing && hrcancel(&t))
+    w.timing = 0;
+  while(w.timing)
+    sleep(&w, &b->lock);
+  release(&b->lock);
+  return r;
+}
+
+// Wake up to n waiters on the word at addr. Returns how many.
+int
+futexwake(uint64 addr, int n)
+{
+  struct proc *p = myproc();
+  struct waiter *w, **wp;
+  struct bucket *b;
+  uint64 key;
+  int woken = 0;
+
+  if(addr % sizeof(uint) != 0 || (key = userwordaddr(p->pagetable, addr)) == 0)
+    return -1;
+  b = bucketof(key);
+
+  acquire(&b->lock);
+  for(wp = &b->head; (w = *wp) != 0 && woken < n; ){
+    if(w->key == key){
+      *wp = w->next;
+      w->state = WOKEN;
+      wakeup(w);
+      woken++;
+    } else {
+      wp = &w->next;
+    }
+  }
+  release(&b->lock);
+  return woken;
+}
+
+void
+futexinit(void)
+{
+  struct bucket *b;
+
+  for(b = futex; b < &futex[NFUTEXHASH]; b++)
+    initlock(&b->lock, "futex");
+}
@@ -0,0 +1,243 @@
+// High-resolution timers.
+//
+// Each hart programs its own CLINT_MTIMECMP for whatever comes due
+// next on it: the earliest timer on its wheel, or its periodic clock
+// tick. timervec in kernelvec.S quiets the comparator when it fires
+// and passes the interrupt on to devintr(), which calls hrintr() to
+// run the timers that are due and program the next one.
+//
+// The wheel is NWHEEL slots of 2^WHEELSHIFT ticks of the time
+// register each; a timer goes in the slot its time falls in, modulo
+// NWHEEL, so adding and removing one are quick, and hrintr() only
+// looks at the slots the time has passed since it last ran.
+//
+// A hart only needs the periodic tick while it runs processes, to
+// preempt them; the scheduler turns it off with hrtick(0) when it
+// has nothing to run, and the hart takes no interrupts but for its
+// timers until it turns it back on.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "hrtimer.h"
+#include "defs.h"
+
+#define NWHEEL     256
+#define WHEELSHIFT 12    // 4096 ticks, 410us on qemu, per slot
+#define NEVER      (~0ULL)
+
+struct wheel {
+  struct spinlock lock;
+  uint64 now;            // slots before this time's are run
+  uint64 next;           // earliest timer on the wheel, or NEVER
+  uint64 tick;           // next periodic tick, or NEVER if idle
+  uint64 prog;           // what MTIMECMP is set to
+  struct hrtimer *slot[NWHEEL];
+};
+
+static struct {
+  uint64 interval;       // between periodic ticks
+  struct wheel wheel[NCPU];
+  struct spinlock sleeplock; // for hrsleep()
+} hr;
+
+// Set this hart's MTIMECMP to the earlier of the next timer and
+// the next tick. w->lock must be held.
+static void
+program(struct wheel *w)
+{
+  uint64 when = w->next < w->tick ? w->next : w->tick;
+
+  if(when != w->prog){
+    w->prog = when;
+    *(uint64*)CLINT_MTIMECMP(cpuid()) = when;
+  }
+}
+
+// Find the earliest timer on w.
+static void
+findnext(struct wheel *w)
+{
+  struct hrtimer *t;
+  int i;
+
+  w->next = NEVER;
+  for(i = 0; i < NWHEEL; i++)
+    for(t = w->slot[i]; t; t = t->next)
+      if(t->when < w->next)
+        w->next = t->when;
+}
+
+// Arm t to call t->fn at time when, on this hart.
+void
+hrstart(struct hrtimer *t, uint64 when)
+{
+  struct wheel *w;
+  struct hrtimer **tp;
+
+  push_off();
+  w = &hr.wheel[cpuid()];
+  acquire(&w->lock);
+  // a time already past fires at the next hrintr().
+  t->when = when > w->now ? when : w->now;
+  t->cpu = cpuid();
+  tp = &w->slot[(t->when >> WHEELSHIFT) % NWHEEL];
+  t->next = *tp;
+  *tp = t;
+  if(t->when < w->next){
+    w->next = t->when;
+    program(w);
+  }
+  release(&w->lock);
+  pop_off();
+}
+
+// Disarm t. Returns 1 if it had not fired, 0 if it has or if
+// hrintr() has taken it to fire.
+int
+hrcancel(struct hrtimer *t)
+{
+  struct wheel *w;
+  struct hrtimer **tp;
+  int cpu;
+
+  if((cpu = __atomic_load_n(&t->cpu, __ATOMIC_ACQUIRE)) < 0)
+    return 0;
+  w = &hr.wheel[cpu];
+  acquire(&w->lock);
+  if(t->cpu != cpu){
+    release(&w->lock);
+    return 0;
+  }
+  for(tp = &w->slot[(t->when >> WHEELSHIFT) % NWHEEL]; *tp; tp = &(*tp)->next){
+    if(*tp == t){
+      *tp = t->next;
+      break;
+    }
+  }
+  t->cpu = -1;
+  // w->next may be early now; hrintr() will find the real one.
+  release(&w->lock);
+  return 1;
+}
+
+// A timer interrupt: run the timers that are due on this hart, and
+// program the next interrupt. Returns 1 if the periodic tick came
+// due. Interrupts are off.
+int
+hrintr(void)
+{
+  struct wheel *w = &hr.wheel[cpuid()];
+  struct hrtimer *t, **tp, *due = 0;
+  uint64 now, s;
+  int n, tick = 0;
+
+  acquire(&w->lock);
+  w->prog = NEVER;    // timervec has quieted MTIMECMP
+  now = r_time();
+  if(now >= w->next){
+    s = w->now >> WHEELSHIFT;
+    for(n = 0; n < NWHEEL && s <= now >> WHEELSHIFT; n++, s++){
+      for(tp = &w->slot[s % NWHEEL]; (t = *tp) != 0; ){
+        if(t->when <= now){
+          *tp = t->next;
+          t->cpu = -1;
+          t->next = due;
+          due = t;
+        } else {
+          tp = &t->next;
+        }
+      }
+    }
+    w->now = now;
+    findnext(w);
+  }
+  if(now >= w->tick){
+    w->tick = now + hr.interval;
+    tick = 1;
+  }
+  program(w);
+  release(&w->lock);
+
+  while((t = due) != 0){
+    due = t->next;
+    t->fn(t);
+  }
+  return tick;
+}
+
+// Turn this hart's periodic tick on or off.
+void
+hrtick(int on)
+{
+  struct wheel *w;
+
+  push_off();
+  w = &hr.wheel[cpuid()];
+  if(on != (w->tick != NEVER)){
+    acquire(&w->lock);
+    w->tick = on ? r_time() + hr.interval : NEVER;
+    program(w);
+    release(&w->lock);
+  }
+  pop_off();
+}
+
+// Set the time between periodic ticks, for the profiler. Each
+// hart takes it at its next tick.
+void
+hrinterval(uint64 interval)
+{
+  hr.interval = interval;
+}
+
+static void
+hrwake(struct hrtimer *t)
+{
+  acquire(&hr.sleeplock);
+  t->arg = 0;
+  wakeup(t);
+  release(&hr.sleeplock);
+}
+
+// Sleep until the time register reaches when. Returns -1 if the
+// process was killed first.
+int
+hrsleep(uint64 when)
+{
+  struct hrtimer t;
+  int r = 0;
+
+  t.fn = hrwake;
+  t.arg = &t;   // cleared when it fires
+  acquire(&hr.sleeplock);
+  hrstart(&t, when);
+  while(t.arg){
+    if(killed(myproc()) && hrcancel(&t)){
+      r = -1;
+      break;
+    }
+    sleep(&t, &hr.sleeplock);
+  }
+  release(&hr.sleeplock);
+  return r;
+}
+
+void
+hrinit(void)
+{
+  struct wheel *w;
+
+  initlock(&hr.sleeplock, "hrsleep");
+  hr.interval = TICKINTERVAL;
+  for(w = hr.wheel; w < &hr.wheel[NCPU]; w++){
+    initlock(&w->lock, "hrtimer");
+    w->now = r_time();
+    w->next = NEVER;
+    w->tick = NEVER;
+    w->prog = NEVER;
+  }
+}
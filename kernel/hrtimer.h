@@ -0,0 +1,8 @@
+// A one-shot timer, see hrtimer.c.
+struct hrtimer {
+  uint64 when;                  // time register value to fire at
+  void (*fn)(struct hrtimer*);  // called, without locks, once it has
+  void *arg;                    // for fn
+  int cpu;                      // whose wheel it is on, -1 if none
+  struct hrtimer *next;         // in its wheel slot
+};
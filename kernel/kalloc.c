@@ -22,11 +22,13 @@ struct run {
 struct {
   struct spinlock lock[NCPU];
   struct run *freelist[NCPU];
+  int nfree[NCPU];        // pages on freelist
 } km;
 
 struct {
   struct spinlock lock;
   int mapcount[PGTOTAL];
+  int nshared;            // pages with a count above 1
 } kmapcount;
 
 void
@@ -81,6 +83,7 @@ kfree(void *pa)
   r = (struct run*)pa;
   r->next = km.freelist[hart];
   km.freelist[hart] = r;
+  km.nfree[hart]++;
   release(&km.lock[hart]);
   pop_off();
 }
@@ -99,6 +102,7 @@ kalloc(void)
   if(r) {
     incmapcount(r, 0);
     km.freelist[hart] = r->next;
+    km.nfree[hart]--;
     memset((char*)r, 5, PGSIZE);
     release(&km.lock[hart]);
     pop_off();
@@ -117,6 +121,7 @@ kalloc(void)
     if (r) {
       incmapcount(r, 0);
       km.freelist[i] = r->next;
+      km.nfree[i]--;
       memset((char*)r, 5, PGSIZE);
       release(&km.lock[i]);
       pop_off();
@@ -129,21 +134,16 @@ kalloc(void)
   return (void*)r;
 }
 
+// Bytes of free memory. Cheap, and only a snapshot: the
+// per-CPU counts are read without their locks.
 uint64
 kfreemem(void) {
   uint64 count = 0;
-  struct run *r;
-  int i = 0;
+  int i;
   for (i = 0; i < NCPU; i++) {
-    acquire(&km.lock[i]);
-    r = km.freelist[i];
-    while (r) {
-      r = r->next;
-      count += PGSIZE;
-    }
-    release(&km.lock[i]);
+    count += km.nfree[i];
   }
-  return count;
+  return count * PGSIZE;
 }
 
 // increase page map count if a child process calls mappages.
@@ -152,7 +152,9 @@ incmapcount(void *pa, int lock) {
   if (lock == 1) {
     acquire(&kmapcount.lock);
   }
-  kmapcount.mapcount[PPN(pa)] += 1;
+  if (++kmapcount.mapcount[PPN(pa)] == 2) {
+    kmapcount.nshared++;
+  }
   if (lock == 1) {
     release(&kmapcount.lock);
   }
@@ -162,11 +164,47 @@ incmapcount(void *pa, int lock) {
 void
 decmapcount(void *pa) {
   acquire(&kmapcount.lock);
-  kmapcount.mapcount[PPN(pa)] -= 1;
+  if (kmapcount.mapcount[PPN(pa)]-- == 2) {
+    kmapcount.nshared--;
+  }
   release(&kmapcount.lock);
 }
 
+// Drop the caller's reference to pa if others hold one too, and
+// return how many are left. Returns 0, leaving the reference in
+// place, if the caller's was the only one: it must then release
+// whatever pa refers to and kfree() it.
+int
+kdropref(void *pa) {
+  int n;
+
+  acquire(&kmapcount.lock);
+  n = kmapcount.mapcount[PPN(pa)];
+  if (n > 1) {
+    kmapcount.mapcount[PPN(pa)] = --n;
+    if (n == 1) {
+      kmapcount.nshared--;
+    }
+  } else {
+    n = 0;
+  }
+  release(&kmapcount.lock);
+  return n;
+}
+
 int
 getmapcount(void *pa) {
   return kmapcount.mapcount[PPN(pa)];
-}
\ No newline at end of file
+}
+
+// Pages the allocator manages.
+int
+ktotalpages(void) {
+  return (PHYSTOP - PGROUNDUP((uint64)end)) / PGSIZE;
+}
+
+// Pages mapped, or otherwise referenced, more than once.
+int
+ksharedpages(void) {
+  return kmapcount.nshared;
+}
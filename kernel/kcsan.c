@@ -28,29 +28,6 @@
 
 #define MAXTRACE 20
 
-int
-trace(uint64 *trace, int maxtrace)
-{
-  uint64 i = 0;
-  
-  push_off();
-  
-  uint64 fp = r_fp();
-  uint64 ra, low = PGROUNDDOWN(fp) + 16, high = PGROUNDUP(fp);
-
-  while(!(fp & 7) && fp >= low && fp < high){
-    ra = *(uint64*)(fp - 8);
-    fp = *(uint64*)(fp - 16);
-    trace[i++] = ra;
-    if(i >= maxtrace)
-      break;
-  }
-
-  pop_off();
-  
-  return i;
-}
-
 struct watch {
   uint64 addr;
   int write;
@@ -0,0 +1,246 @@
+// Same-page merging.
+//
+// When a hart has nothing to run, the scheduler calls ksmidle(),
+// which, at most once a tick, looks at the next KSMBATCH pages of
+// user memory for pages with the same contents. Only pages that
+// nobody can write are candidates: copy-on-write pages (PTE_M) and
+// read-only anonymous memory. Pages backed by files are left alone,
+// since the page cache changes them in place.
+//
+// A candidate is hashed and looked up in a table of stable pages.
+// If a stable page has the same contents, the candidate's PTE is
+// pointed at the stable page, copy-on-write as before, and the
+// candidate page is released. If not, the candidate becomes a
+// stable page itself. The table holds a map count reference on
+// each stable page, so that a store to any of its mappings copies
+// it and its contents never change; a stable page is dropped from
+// the table once that reference is the only one left.
+//
+// As with swap, only processes preempted in user space are looked
+// at, with their lock held (pagetableidle()): one stopped anywhere
+// in the kernel, say in cowfault() between copying a page and
+// storing its PTE, may still be using the page it would lose.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+#include "defs.h"
+
+#define NKSM       1024  // stable pages
+#define NKSMHASH   256   // hash buckets
+#define KSMBATCH   256   // pages looked at per tick
+#define KSMGC      16    // table entries checked per tick
+
+extern struct proc proc[NPROC];
+extern uint ticks;
+
+struct stable {
+  uint64 hash;
+  char *pa;               // 0 if the entry is free
+  struct stable *next;    // in its hash bucket
+};
+
+struct {
+  struct spinlock lock;
+  struct stable page[NKSM];
+  struct stable *bucket[NKSMHASH];
+  int nstable;
+  uint lastscan;          // ticks at the last scan
+  int hand;               // clock hand: index in proc[]
+  uint64 handva;          // and address within it
+  int gchand;             // next entry to check for release
+  uint64 nscanned;        // candidate pages hashed
+  uint64 nmerged;         // pages released by merging
+} ksm;
+
+static uint64
+pagehash(char *pa)
+{
+  uint64 *w = (uint64*)pa, h = 14695981039346656037UL;
+  int i;
+
+  for(i = 0; i < PGSIZE / sizeof(uint64); i++){
+    h ^= w[i];
+    h *= 1099511628211UL;
+  }
+  return h;
+}
+
+// Make pa a stable page, if there is room.
+static void
+ksminsert(char *pa, uint64 hash)
+{
+  struct stable *s;
+
+  for(s = ksm.page; s < &ksm.page[NKSM]; s++){
+    if(s->pa == 0){
+      incmapcount(pa, 1);
+      s->pa = pa;
+      s->hash = hash;
+      s->next = ksm.bucket[hash % NKSMHASH];
+      ksm.bucket[hash % NKSMHASH] = s;
+      ksm.nstable++;
+      return;
+    }
+  }
+}
+
+static void
+ksmremove(struct stable *s)
+{
+  struct stable **pp;
+
+  for(pp = &ksm.bucket[s->hash % NKSMHASH]; *pp != s; pp = &(*pp)->next)
+    ;
+  *pp = s->next;
+  kfree(s->pa);
+  s->pa = 0;
+  ksm.nstable--;
+}
+
+void
+ksminit(void)
+{
+  char *zero = uvmzeropage();
+
+  initlock(&ksm.lock, "ksm");
+  // pages of zeros merge into the one untouched heap maps.
+  ksminsert(zero, pagehash(zero));
+}
+
+// Could the page at va, mapped by pte, be merged?
+static int
+mergeable(struct proc *p, uint64 va, pte_t pte)
+{
+  struct vma *v;
+
+  if((pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U))
+    return 0;
+  if(va < p->sz)
+    return !intext(p, va);
+  if(va >= MMAPBASE && (v = vmalookup(p, va)) != 0)
+    return v->f == 0 && (v->flags & MAP_PRIVATE);
+  return 0;
+}
+
+// Merge the page that pte maps, if a stable page has its contents.
+// Returns 1 if it was merged.
+static int
+ksmmerge(pte_t *pte)
+{
+  char *pa = (char*)PTE2PA(*pte);
+  uint64 h = pagehash(pa);
+  struct stable *s;
+
+  ksm.nscanned++;
+  for(s = ksm.bucket[h % NKSMHASH]; s; s = s->next){
+    if(s->pa == pa)
+      return 0;  // already stable
+    if(s->hash == h && memcmp(s->pa, pa, PGSIZE) == 0){
+      incmapcount(s->pa, 1);
+      *pte = PA2PTE(s->pa) | PTE_FLAGS(*pte);
+      kfree(pa);
+      ksm.nmerged++;
+      return 1;
+    }
+  }
+  ksminsert(pa, h);
+  return 0;
+}
+
+// Move the hand over up to n pages of p. Sets *done if it
+// reached the end of p. Returns the number of pages looked at.
+// Caller holds p->lock and ksm.lock.
+static int
+ksmscan(struct proc *p, int n, int *done)
+{
+  uint64 va = ksm.handva;
+  int seen = 0, merged = 0;
+  pte_t *pte;
+
+  while(seen < n && (pte = walknext(p->pagetable, &va, MMAPTOP)) != 0){
+    if(mergeable(p, va, *pte)){
+      merged |= ksmmerge(pte);
+      seen++;
+    }
+    va += PGSIZE;
+  }
+  ksm.handva = va;
+  *done = va >= MMAPTOP;
+  if(merged)
+    p->tlbstale = (1L << NCPU) - 1;
+  return seen;
+}
+
+// Called by an idle hart's scheduler, with no locks held.
+void
+ksmidle(void)
+{
+  struct proc *p;
+  int i, seen = 0, visits, done;
+
+  acquire(&ksm.lock);
+  if(ksm.lastscan == ticks){
+    release(&ksm.lock);
+    return;
+  }
+  ksm.lastscan = ticks;
+
+  // release stable pages that only the table holds now.
+  for(i = 0; i < KSMGC; i++){
+    if(ksm.page[ksm.gchand].pa && getmapcount(ksm.page[ksm.gchand].pa) == 1)
+      ksmremove(&ksm.page[ksm.gchand]);
+    ksm.gchand = (ksm.gchand + 1) % NKSM;
+  }
+
+  for(visits = 0; visits < NPROC && seen < KSMBATCH; ){
+    p = &proc[ksm.hand];
+    done = 1;
+    acquire(&p->lock);
+    if(pagetableidle(p))
+      seen += ksmscan(p, KSMBATCH - seen, &done);
+    release(&p->lock);
+    if(done){
+      ksm.hand = (ksm.hand + 1) % NPROC;
+      ksm.handva = 0;
+      visits++;
+    }
+  }
+  release(&ksm.lock);
+}
+
+// Pages the stable table holds.
+int
+ksmpages(void)
+{
+  return ksm.nstable;
+}
+
+// Print merging statistics into buf, for the statistics device.
+int
+statsksm(char *buf, int sz)
+{
+  struct stable *s;
+  int maps, nmaps = 0, saved = 0;
+
+  acquire(&ksm.lock);
+  for(s = ksm.page; s < &ksm.page[NKSM]; s++){
+    if(s->pa == 0)
+      continue;
+    // one physical page instead of one per mapping.
+    maps = getmapcount(s->pa) - 1;
+    nmaps += maps;
+    if(maps > 1)
+      saved += maps - 1;
+  }
+  release(&ksm.lock);
+  return snprintf(buf, sz, "ksm: %d stable pages, %d mappings, %d pages saved, %d merged, %d scanned\n",
+                  ksm.nstable, nmaps, saved, (int)ksm.nmerged, (int)ksm.nscanned);
+}
@@ -0,0 +1,261 @@
+// Lock profiling.
+//
+// Every acquisition of a spinlock or a sleeplock is charged to its
+// site: the lock's name and the return address of the acquire() or
+// acquiresleep() call. A site counts its acquisitions and how many
+// of them had to wait, and keeps the total and the longest of its
+// wait times, from the call until the lock was taken, and of its
+// hold times, from then until the release, with a histogram of each
+// in power-of-two buckets. Times are in ticks of the time register,
+// the same units the profiler, the system call tracer and the timers
+// use.
+//
+// acquire() calls in here, so nothing here takes a spinlock. Each
+// cpu counts into a row of its own, with interrupts off; a hart
+// allocates its row as it starts, and what it acquires before then
+// is not counted. Sites are shared, and only ever added, under a
+// bare test-and-set word; they are numbered in the order they were
+// added, and found through an open hash table that is never more
+// than half full. Once NLOCKSITE sites are in, acquisitions at new
+// ones are only counted as lost, without waiting for that word.
+//
+// Reading the statistics device prints a line per site, for
+// user/lockstat.c to sort; writing to it clears the counts.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NLOCKSITE  384   // acquire sites; the kernel has about 150
+#define NLOCKHASH  1024  // slots in the site hash table
+#define NLOCKHIST  20    // buckets in wait and hold histograms
+
+struct locksite {
+  uint64 pc;
+  char *name;
+  int sleep;             // a sleeplock
+};
+
+struct lockprof {
+  uint64 nacq;
+  uint64 nwait;          // acquisitions that had to wait
+  uint64 wait, waitmax;
+  uint64 hold, holdmax;
+  uint whist[NLOCKHIST];
+  uint hhist[NLOCKHIST];
+};
+
+// a cpu's row is in pages of NPERPAGE sites each.
+#define NPERPAGE   (PGSIZE / sizeof(struct lockprof))
+#define NROWPAGE   ((NLOCKSITE + NPERPAGE - 1) / NPERPAGE)
+
+static struct {
+  uint addlock;          // held to add a site
+  int nlost;             // acquisitions with no room for their site
+  int nsite;             // sites added
+  struct locksite site[NLOCKSITE];
+  ushort hash[NLOCKHASH];  // 1 + a site, or 0 if the slot is free
+  struct lockprof *prof[NCPU][NROWPAGE];
+} lockstat;
+
+// cpu c's counts for site i, or 0 if c has not allocated them.
+static struct lockprof*
+profof(int c, int i)
+{
+  struct lockprof *pg;
+
+  pg = __atomic_load_n(&lockstat.prof[c][i / NPERPAGE], __ATOMIC_ACQUIRE);
+  return pg ? &pg[i % NPERPAGE] : 0;
+}
+
+// Allocate this cpu's row of counts.
+void
+lockstatinithart(void)
+{
+  struct lockprof *pg;
+  int i;
+
+  for(i = 0; i < NROWPAGE; i++){
+    if((pg = kalloc()) == 0)
+      panic("lockstatinithart");
+    memset(pg, 0, PGSIZE);
+    __atomic_store_n(&lockstat.prof[cpuid()][i], pg, __ATOMIC_RELEASE);
+  }
+}
+
+static int
+bucket(uint64 t)
+{
+  int b;
+
+  for(b = 0; t > 0 && b < NLOCKHIST-1; b++)
+    t >>= 1;
+  return b;
+}
+
+// Look for the site of name's lock acquired at pc. Returns its
+// number, or -1 and the free hash slot that ends its probe in
+// *free. The table always has free slots, so probes are short.
+static int
+lookup(char *name, uint64 pc, int *free)
+{
+  struct locksite *s;
+  int i, n;
+
+  i = ((pc >> 1) ^ (uint64)name) % NLOCKHASH;
+  for(;;){
+    if((n = __atomic_load_n(&lockstat.hash[i], __ATOMIC_ACQUIRE)) == 0){
+      *free = i;
+      return -1;
+    }
+    s = &lockstat.site[n-1];
+    if(s->pc == pc && s->name == name)
+      return n-1;
+    i = (i + 1) % NLOCKHASH;
+  }
+}
+
+static int
+findsite(char *name, uint64 pc, int sleep)
+{
+  struct locksite *s;
+  int i, free;
+
+  if((i = lookup(name, pc, &free)) >= 0)
+    return i;
+  if(__atomic_load_n(&lockstat.nsite, __ATOMIC_ACQUIRE) >= NLOCKSITE)
+    return -1;
+
+  while(__sync_lock_test_and_set(&lockstat.addlock, 1) != 0)
+    ;
+  if((i = lookup(name, pc, &free)) < 0 && lockstat.nsite < NLOCKSITE){
+    i = lockstat.nsite;
+    s = &lockstat.site[i];
+    s->pc = pc;
+    s->name = name;
+    s->sleep = sleep;
+    // lookup() and statslockstat() read the site once they
+    // see it in the hash table or counted in nsite.
+    __atomic_store_n(&lockstat.nsite, i + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&lockstat.hash[free], i + 1, __ATOMIC_RELEASE);
+  }
+  __sync_lock_release(&lockstat.addlock);
+  return i;
+}
+
+// Charge the acquisition of name's lock at pc to its site. The
+// caller has just taken the lock, with interrupts off, having begun
+// at start and waited if waited is set. Returns the site, for the
+// caller to give lockreleased().
+int
+lockacquired(char *name, uint64 pc, int sleep, uint64 start, int waited)
+{
+  struct lockprof *lp;
+  uint64 t = 0;
+  int i;
+
+  if((i = findsite(name, pc, sleep)) < 0){
+    lockstat.nlost++;
+    return -1;
+  }
+  if((lp = profof(cpuid(), i)) == 0)
+    return -1;
+  lp->nacq++;
+  if(waited){
+    t = r_time() - start;
+    lp->nwait++;
+    lp->wait += t;
+    if(t > lp->waitmax)
+      lp->waitmax = t;
+  }
+  lp->whist[bucket(t)]++;
+  return i;
+}
+
+// Charge the hold time of a lock taken at start to site, before
+// the lock is released. Interrupts must be off.
+void
+lockreleased(int site, uint64 start)
+{
+  struct lockprof *lp;
+  uint64 t;
+
+  if(site < 0)
+    return;
+  if((lp = profof(cpuid(), site)) == 0)
+    return;
+  t = r_time() - start;
+  lp->hold += t;
+  if(t > lp->holdmax)
+    lp->holdmax = t;
+  lp->hhist[bucket(t)]++;
+}
+
+// Clear the counts, keeping the sites.
+void
+lockstatreset(void)
+{
+  struct lockprof *pg;
+  int c, i;
+
+  for(c = 0; c < NCPU; c++){
+    for(i = 0; i < NROWPAGE; i++){
+      if((pg = __atomic_load_n(&lockstat.prof[c][i], __ATOMIC_ACQUIRE)) != 0)
+        memset(pg, 0, PGSIZE);
+    }
+  }
+  lockstat.nlost = 0;
+}
+
+// Print a line per site into buf, for the statistics device:
+//   lockstat: pc sleep nacq nwait wait waitmax hold holdmax
+//             whist... hhist... name
+// Sites that do not fit in sz are left out.
+int
+statslockstat(char *buf, int sz)
+{
+  struct lockprof sum;
+  struct lockprof *lp;
+  struct locksite *s;
+  int i, c, b, nsite, n = 0;
+
+  nsite = __atomic_load_n(&lockstat.nsite, __ATOMIC_ACQUIRE);
+  for(i = 0; i < nsite; i++){
+    s = &lockstat.site[i];
+    memset(&sum, 0, sizeof(sum));
+    for(c = 0; c < NCPU; c++){
+      if((lp = profof(c, i)) == 0)
+        continue;
+      sum.nacq += lp->nacq;
+      sum.nwait += lp->nwait;
+      sum.wait += lp->wait;
+      sum.hold += lp->hold;
+      if(lp->waitmax > sum.waitmax)
+        sum.waitmax = lp->waitmax;
+      if(lp->holdmax > sum.holdmax)
+        sum.holdmax = lp->holdmax;
+      for(b = 0; b < NLOCKHIST; b++){
+        sum.whist[b] += lp->whist[b];
+        sum.hhist[b] += lp->hhist[b];
+      }
+    }
+    if(sum.nacq == 0)
+      continue;
+    // snprintf() can run a number past sz; stop well short of it.
+    if(sz - n < 512)
+      break;
+    n += snprintf(buf+n, sz-n, "lockstat: %p %d %ld %ld %ld %ld %ld %ld",
+                  s->pc, s->sleep, sum.nacq, sum.nwait, sum.wait,
+                  sum.waitmax, sum.hold, sum.holdmax);
+    for(b = 0; b < NLOCKHIST; b++)
+      n += snprintf(buf+n, sz-n, " %d", sum.whist[b]);
+    for(b = 0; b < NLOCKHIST; b++)
+      n += snprintf(buf+n, sz-n, " %d", sum.hhist[b]);
+    n += snprintf(buf+n, sz-n, " %s\n", s->name);
+  }
+  if(lockstat.nlost && sz - n >= 128)
+    n += snprintf(buf+n, sz-n, "lockstat: %d acquisitions at sites that did not fit\n",
+                  lockstat.nlost);
+  return n;
+}
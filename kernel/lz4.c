@@ -0,0 +1,173 @@
+// LZ4 block compression, for compressed swap.
+//
+// Output is an LZ4 block: a sequence of tokens, each a count of
+// literal bytes that follow it and then a match, a 16-bit offset
+// back into the output and a length, with counts of 15 and more
+// continued in extra bytes of 255. The compressor is the greedy
+// single-probe one: a hash of the 4 bytes at each position finds
+// the last position with the same hash, which is taken if its 4
+// bytes really match. It skips ahead faster the longer it goes
+// without a match, so incompressible data costs little.
+//
+// Inputs are at most a page, so positions fit in a ushort.
+// lz4compress() keeps its hash table in static memory and is not
+// reentrant; its caller serializes.
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define MINMATCH   4
+#define LASTLITS   5    // the last 5 bytes are always literals
+#define MFLIMIT    12   // no match starts in the last 12 bytes
+#define HASHBITS   10
+
+static ushort table[1 << HASHBITS];
+
+static uint
+read4(uchar *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint)p[3] << 24);
+}
+
+static uint
+hash4(uchar *p)
+{
+  return (read4(p) * 2654435761U) >> (32 - HASHBITS);
+}
+
+// Append a length of at least 15 to a token's nibble.
+static int
+putlen(uchar *op, int len)
+{
+  int n = 0;
+
+  for(len -= 15; len >= 255; len -= 255)
+    op[n++] = 255;
+  op[n++] = len;
+  return n;
+}
+
+// Compress n bytes at src into dst. Returns the compressed size,
+// or 0 if it would be more than max.
+int
+lz4compress(uchar *src, int n, uchar *dst, int max)
+{
+  int ip = 0, anchor = 0, ref, lits, mlen, need, misses = 0;
+  int op = 0;
+  uint h;
+  uchar *token;
+
+  if(n > 65535)
+    panic("lz4compress");
+  memset(table, 0, sizeof(table));
+
+  while(ip < n - MFLIMIT){
+    h = hash4(src + ip);
+    ref = table[h];
+    table[h] = ip;
+    if(ref >= ip || read4(src + ref) != read4(src + ip)){
+      ip += 1 + (misses++ >> 6);
+      continue;
+    }
+    misses = 0;
+
+    // extend the match forwards, and backwards over literals.
+    mlen = MINMATCH;
+    while(ip + mlen < n - LASTLITS && src[ip + mlen] == src[ref + mlen])
+      mlen++;
+    while(ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]){
+      ip--;
+      ref--;
+      mlen++;
+    }
+
+    lits = ip - anchor;
+    need = 1 + lits + lits / 255 + 1 + 2 + (mlen - MINMATCH) / 255 + 1;
+    if(op + need > max)
+      return 0;
+    token = &dst[op++];
+    *token = (lits < 15 ? lits : 15) << 4;
+    if(lits >= 15)
+      op += putlen(&dst[op], lits);
+    memmove(&dst[op], &src[anchor], lits);
+    op += lits;
+    dst[op++] = (ip - ref) & 0xff;
+    dst[op++] = (ip - ref) >> 8;
+    *token |= mlen - MINMATCH < 15 ? mlen - MINMATCH : 15;
+    if(mlen - MINMATCH >= 15)
+      op += putlen(&dst[op], mlen - MINMATCH);
+
+    ip += mlen;
+    anchor = ip;
+  }
+
+  // the rest goes out as literals, in a token with no match.
+  lits = n - anchor;
+  if(op + 1 + lits + lits / 255 + 1 > max)
+    return 0;
+  token = &dst[op++];
+  *token = (lits < 15 ? lits : 15) << 4;
+  if(lits >= 15)
+    op += putlen(&dst[op], lits);
+  memmove(&dst[op], &src[anchor], lits);
+  op += lits;
+  return op;
+}
+
+// Read the rest of a length that started at 15 in a token.
+// Returns -1 if the input ends first.
+static int
+getlen(uchar *src, int n, int *ip, int len)
+{
+  uchar b;
+
+  do {
+    if(*ip >= n)
+      return -1;
+    b = src[(*ip)++];
+    len += b;
+  } while(b == 255);
+  return len;
+}
+
+// Decompress the n-byte block at src into dst, which has room for
+// max bytes. Returns the decompressed size, or -1 if src is not a
+// well-formed block or does not fit.
+int
+lz4decompress(uchar *src, int n, uchar *dst, int max)
+{
+  int ip = 0, op = 0, len, off;
+  uchar token;
+
+  while(ip < n){
+    token = src[ip++];
+    len = token >> 4;
+    if(len == 15 && (len = getlen(src, n, &ip, len)) < 0)
+      return -1;
+    if(len > n - ip || len > max - op)
+      return -1;
+    memmove(&dst[op], &src[ip], len);
+    ip += len;
+    op += len;
+    if(ip == n)
+      break;  // the last token has no match
+
+    if(n - ip < 2)
+      return -1;
+    off = src[ip] | (src[ip + 1] << 8);
+    ip += 2;
+    if(off == 0 || off > op)
+      return -1;
+    len = token & 15;
+    if(len == 15 && (len = getlen(src, n, &ip, len)) < 0)
+      return -1;
+    len += MINMATCH;
+    if(len > max - op)
+      return -1;
+    // the match may overlap what it produces.
+    for(; len > 0; len--, op++)
+      dst[op] = dst[op - off];
+  }
+  return op;
+}
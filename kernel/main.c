@@ -12,24 +12,31 @@ main()
 {
   if(cpuid() == 0){
     consoleinit();
-#if defined(LAB_LOCK)
     statsinit();
-#endif
+    profinit();
+    systraceinit();
     printfinit();
     printf("\n");
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    lockstatinithart(); // lock profile counts
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
     trapinit();      // trap vectors
+    hrinit();        // high-resolution timers
+    futexinit();     // futex wait queues
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
+    pinit();         // file page cache
     iinit();         // inode table
     fileinit();      // file table
+    swapinit();      // swap space
+    ksminit();       // same-page merging
+    wssinit();       // working-set sampling
     virtio_disk_init(); // emulated hard disk
 #ifdef LAB_NET
     pci_init();
@@ -46,6 +53,7 @@ main()
       ;
     __sync_synchronize();
     printf("hart %d starting\n", cpuid());
+    lockstatinithart(); // lock profile counts
     kvminithart();    // turn on paging
     trapinithart();   // install kernel trap vector
     plicinithart();   // ask PLIC for device interrupts
@@ -33,6 +33,7 @@
 #define CLINT 0x2000000L
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid)) // machine software interrupt
 
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
@@ -66,11 +67,14 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   mmap() regions, from MMAPBASE up to MMAPTOP
+//   THREADFRAME (the trapframes of clone()d threads)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define THREADFRAME(p) (TRAPFRAME - ((p)+1)*PGSIZE)
 #define MMAPBASE (TRAPFRAME - (1L << 31))
-#define MMAPMAX (268*1024*1024)
+#define MMAPTOP (THREADFRAME(NPROC) - PGSIZE)
 
 #ifdef LAB_PGTBL
 #define USYSCALL (TRAPFRAME - PGSIZE)
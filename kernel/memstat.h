@@ -0,0 +1,26 @@
+#include "types.h"
+#include "param.h"
+
+// Memory use, in pages, as memstat() reports it.
+struct memstat {
+  // the whole system
+  uint64 total;       // physical pages the allocator manages
+  uint64 free;        // of which free
+  uint64 shared;      // mapped more than once, copy-on-write or merged
+  uint64 pagetable;   // page-table pages
+  uint64 pcache;      // page cache
+  uint64 ksm;         // stable pages held for merging
+  uint64 zswap;       // pages in the compressed swap pool
+  uint64 zpool;       // memory the pool takes
+  uint64 swap;        // swap slots on disk in use
+  uint64 swaptotal;   // and in all
+
+  // the process asked about
+  uint64 rss;         // user pages mapped
+  uint64 rssmmap;     // of which mmap()ed
+  uint64 swapped;     // user pages on swap
+  uint64 ptpages;     // page-table pages
+  uint64 wss;         // working set, as last sampled
+  uint64 hist[NWSSHIST];  // resident pages by periods since last use:
+                          // 0, 1, 2-3, 4-7, ..., and older
+};
@@ -0,0 +1,12 @@
+struct page {
+  int valid;   // has data been read from the file?
+  uint dev;
+  uint inum;
+  uint pgno;   // page number within the file
+  struct sleeplock lock;
+  uint refcnt;
+  struct page *prev; // LRU cache list
+  struct page *next;
+  char *data;  // a kalloc()ed page, or 0
+};
+
@@ -1,7 +1,8 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
-#define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
+#define NOFILE       16  // initial open files per process
+#define NOFILEMAX   512  // maximum open files per process
+#define NFILE       100  // statically allocated open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
@@ -9,6 +10,16 @@
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NPCACHE      256  // initial entries in the file page cache
+#define NFAULTAROUND 16  // mmap pages mapped per page fault
+#define NVMA          8  // initial mapped regions per process
+#define NSWAP      1024  // pages of swap space on disk
+#define NZPOOL      256  // pages of memory for compressed swap
+#define NWSSHIST      8  // buckets in working-set age histograms
+#define TICKINTERVAL 1000000  // timer cycles per clock tick; about 1/10th second in qemu
+#define NSPERTIME    100      // nanoseconds per timer cycle, in qemu
+#define NICEMIN      -20      // most CPU a process can ask for
+#define NICEMAX      19       // least
 #ifdef LAB_FS
 #define FSSIZE       200000  // size of file system in blocks
 #else
@@ -0,0 +1,272 @@
+// Page cache.
+//
+// The page cache holds whole PGSIZE pages of file contents, each
+// in a physical page of its own, so that a cached page can be
+// mapped straight into user page tables. readi() reads files
+// through it, exec() maps program text from it, and mmap() maps
+// file pages from it, so every process mapping or running the
+// same file shares one physical copy, and a read() after a store
+// to a MAP_SHARED page sees the store. The buffer cache below
+// stays the write path: writei() logs the blocks and then copies
+// the new bytes into the cached page with pwrite().
+//
+// Interface:
+// * To get a page of a file, call pread with the inode locked.
+// * When done with the page, call prelse.
+// * Do not use p->data after calling prelse, unless you took
+//     your own reference to it with incmapcount().
+// * Call pinval when a file's contents change underneath
+//     the cache.
+//
+// The cache keeps one mapcount reference on each p->data. An entry
+// whose data is still mapped by some process is not recycled, so
+// that every MAP_SHARED mapping of a file page, and every futex
+// waiting on one, sees the same physical page. A bucket whose
+// entries are all in use or mapped grows by a page of entries;
+// only when that fails does pread return 0.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+#include "page.h"
+
+#define NPBUCKET 16
+
+struct {
+  struct spinlock lock;
+  struct page page[NPCACHE/NPBUCKET];
+
+  // Linked list of all pages, through prev/next.
+  // Sorted by how recently the page was used.
+  // head.next is most recent, head.prev is least.
+  struct page head;
+} pcache[NPBUCKET];
+
+static int npages;        // pages holding data
+
+#define NPGROW (PGSIZE / sizeof(struct page))
+
+static int
+phash(uint inum, uint pgno)
+{
+  return (inum * 31 + pgno) % NPBUCKET;
+}
+
+void
+pinit(void)
+{
+  struct page *p;
+  int i;
+
+  for(i = 0; i < NPBUCKET; i++){
+    initlock(&pcache[i].lock, "pcache");
+    pcache[i].head.prev = &pcache[i].head;
+    pcache[i].head.next = &pcache[i].head;
+    for(p = pcache[i].page; p < pcache[i].page+NPCACHE/NPBUCKET; p++){
+      p->next = pcache[i].head.next;
+      p->prev = &pcache[i].head;
+      initsleeplock(&p->lock, "page");
+      pcache[i].head.next->prev = p;
+      pcache[i].head.next = p;
+    }
+  }
+}
+
+// Add a page's worth of entries to the LRU end of bucket h, all
+// of whose entries are in use or mapped. Returns one of them, or
+// 0 if out of memory. Caller holds pcache[h].lock.
+static struct page*
+pgrow(int h)
+{
+  struct page *new, *p;
+
+  if((new = kalloc()) == 0)
+    return 0;
+  memset(new, 0, PGSIZE);
+  for(p = new; p < new + NPGROW; p++){
+    initsleeplock(&p->lock, "page");
+    p->prev = pcache[h].head.prev;
+    p->next = &pcache[h].head;
+    pcache[h].head.prev->next = p;
+    pcache[h].head.prev = p;
+  }
+  return new;
+}
+
+// Look through the page cache for page pgno of inode inum on
+// device dev. If not found, recycle an entry that no one is
+// using or has mapped, or add one. In either case, return
+// locked page. Returns 0 if out of memory.
+static struct page*
+pget(uint dev, uint inum, uint pgno)
+{
+  struct page *p;
+  int h = phash(inum, pgno);
+
+  acquire(&pcache[h].lock);
+
+  // Is the page already cached?
+  for(p = pcache[h].head.next; p != &pcache[h].head; p = p->next){
+    if(p->dev == dev && p->inum == inum && p->pgno == pgno){
+      p->refcnt++;
+      release(&pcache[h].lock);
+      acquiresleep(&p->lock);
+      return p;
+    }
+  }
+
+  // Not cached.
+  // Recycle the least recently used (LRU) unused entry.
+  for(p = pcache[h].head.prev; p != &pcache[h].head; p = p->prev){
+    if(p->refcnt == 0 && (p->data == 0 || getmapcount(p->data) <= 1))
+      break;
+  }
+  if(p == &pcache[h].head && (p = pgrow(h)) == 0){
+    release(&pcache[h].lock);
+    return 0;
+  }
+  p->dev = dev;
+  p->inum = inum;
+  p->pgno = pgno;
+  p->valid = 0;
+  p->refcnt = 1;
+  release(&pcache[h].lock);
+  acquiresleep(&p->lock);
+  return p;
+}
+
+// Return a locked page holding page pgno of ip's contents, or 0
+// if out of memory. Bytes past the end of the file are zero.
+// Caller must hold ip->lock.
+struct page*
+pread(struct inode *ip, uint pgno)
+{
+  struct page *p;
+
+  if((p = pget(ip->dev, ip->inum, pgno)) == 0)
+    return 0;
+  if(!p->valid){
+    if(p->data && getmapcount(p->data) > 1){
+      // an invalidated page still mapped by some process;
+      // leave it to them.
+      kfree(p->data);
+      p->data = 0;
+      __sync_fetch_and_sub(&npages, 1);
+    }
+    if(p->data == 0){
+      if((p->data = kalloc()) == 0){
+        prelse(p);
+        return 0;
+      }
+      __sync_fetch_and_add(&npages, 1);
+    }
+    memset(p->data, 0, PGSIZE);
+    ireadblocks(ip, p->data, pgno*PGSIZE, PGSIZE);
+    p->valid = 1;
+  }
+  return p;
+}
+
+// Pages the cache holds data in.
+int
+pcachepages(void)
+{
+  return npages;
+}
+
+// Release a locked page.
+// Move to the head of the most-recently-used list.
+void
+prelse(struct page *p)
+{
+  int h = phash(p->inum, p->pgno);
+
+  if(!holdingsleep(&p->lock))
+    panic("prelse");
+
+  releasesleep(&p->lock);
+
+  acquire(&pcache[h].lock);
+  p->refcnt--;
+  if(p->refcnt == 0){
+    // no one is waiting for it.
+    p->next->prev = p->prev;
+    p->prev->next = p->next;
+    p->next = pcache[h].head.next;
+    p->prev = &pcache[h].head;
+    pcache[h].head.next->prev = p;
+    pcache[h].head.next = p;
+  }
+  release(&pcache[h].lock);
+}
+
+// Copy n bytes at src into the cached copy of ip's contents at
+// off, if that page is cached. The bytes must lie within one page.
+// Caller must hold ip->lock.
+void
+pwrite(struct inode *ip, uint off, char *src, uint n)
+{
+  struct page *p;
+  uint pgno = off / PGSIZE;
+  int h = phash(ip->inum, pgno);
+
+  acquire(&pcache[h].lock);
+  for(p = pcache[h].head.next; p != &pcache[h].head; p = p->next){
+    if(p->dev == ip->dev && p->inum == ip->inum && p->pgno == pgno)
+      break;
+  }
+  if(p == &pcache[h].head){
+    release(&pcache[h].lock);
+    return;
+  }
+  p->refcnt++;
+  release(&pcache[h].lock);
+
+  acquiresleep(&p->lock);
+  if(p->valid)
+    memmove(p->data + off % PGSIZE, src, n);
+  prelse(p);
+}
+
+// Forget cached pages first..last of ip, because the file's
+// contents changed. Processes that have the old pages mapped
+// keep them.
+void
+pinval(struct inode *ip, uint first, uint last)
+{
+  struct page *p;
+  uint pgno;
+  int h;
+
+  for(pgno = first; pgno <= last; pgno++){
+    h = phash(ip->inum, pgno);
+    acquire(&pcache[h].lock);
+    for(p = pcache[h].head.next; p != &pcache[h].head; p = p->next){
+      if(p->dev == ip->dev && p->inum == ip->inum && p->pgno == pgno)
+        p->valid = 0;
+    }
+    release(&pcache[h].lock);
+  }
+}
+
+// Forget all cached pages of ip, e.g. when it is truncated.
+void
+pinvalall(struct inode *ip)
+{
+  struct page *p;
+  int h;
+
+  for(h = 0; h < NPBUCKET; h++){
+    acquire(&pcache[h].lock);
+    for(p = pcache[h].head.next; p != &pcache[h].head; p = p->next){
+      if(p->dev == ip->dev && p->inum == ip->inum)
+        p->valid = 0;
+    }
+    release(&pcache[h].lock);
+  }
+}
@@ -134,6 +134,36 @@ printfinit(void)
   pr.locking = 1;
 }
 
+// Walk the frame pointers from fp, which must be in a kernel
+// stack, and put the return addresses of up to maxtrace frames in
+// trace. Stops at the end of fp's stack page. Returns the number
+// of frames.
+int
+tracefrom(uint64 fp, uint64 *trace, int maxtrace)
+{
+  uint64 ra, low = PGROUNDDOWN(fp) + 16, high = PGROUNDUP(fp);
+  int i = 0;
+
+  while(i < maxtrace && !(fp & 7) && fp >= low && fp < high){
+    ra = *(uint64*)(fp - 8);
+    fp = *(uint64*)(fp - 16);
+    trace[i++] = ra;
+  }
+  return i;
+}
+
+// The return addresses of trace()'s caller and its callers.
+int
+trace(uint64 *trace, int maxtrace)
+{
+  int n;
+
+  push_off();
+  n = tracefrom(r_fp(), trace, maxtrace);
+  pop_off();
+  return n;
+}
+
 void
 backtrace()
 {
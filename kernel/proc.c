@@ -3,7 +3,9 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
+#include "cpustat.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
@@ -26,6 +28,117 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
+// A process's threads serialize changes to the memory they share
+// with one of these, see vmlock().
+static struct sleeplock vmlocks[NPROC];
+
+// The run queue: the RUNNABLE processes, in order of virtual
+// runtime. A process's vruntime grows by the time it runs,
+// scaled down by its weight, so the scheduler, always taking the
+// one with the least, shares the CPUs out in proportion to weight.
+// runq.lock is taken after any p->lock.
+static struct {
+  struct spinlock lock;
+  struct proc *head;
+  uint64 minvruntime;    // of the last process taken; never goes back
+} runq;
+
+// A process that wakes up can be at most this far behind the
+// others, so a long sleep does not buy it a long run.
+#define SLEEPERCREDIT (TICKINTERVAL / 2)
+
+// A hart runs a process that last ran on it, whose caches and
+// kalloc() free list are warm there, ahead of one that has had
+// up to this much less vruntime.
+#define CACHEHOT (TICKINTERVAL / 10)
+
+// Harts that have started scheduling.
+static uint64 online;
+
+// Weights by nice - NICEMIN, as Linux's: each step is about 10% more
+// or less CPU than the one before.
+#define NICE0WEIGHT 1024
+static const int niceweight[NICEMAX - NICEMIN + 1] = {
+  88761, 71755, 56483, 46273, 36291,
+  29154, 23254, 18705, 14949, 11916,
+  9548,  7620,  6100,  4904,  3906,
+  3121,  2501,  1991,  1586,  1277,
+  1024,  820,   655,   526,   423,
+  335,   272,   215,   172,   137,
+  110,   87,    70,    56,    45,
+  36,    29,    23,    18,    15,
+};
+
+// Make p RUNNABLE, and queue it by vruntime. If it woke from a
+// sleep, catch it up to near the others first.
+// p->lock must be held.
+static void
+setrunnable(struct proc *p, int woke)
+{
+  struct proc **pp;
+  uint64 min;
+
+  acquire(&runq.lock);
+  min = runq.minvruntime;
+  if(woke && min > SLEEPERCREDIT && p->vruntime < min - SLEEPERCREDIT)
+    p->vruntime = min - SLEEPERCREDIT;
+  p->state = RUNNABLE;
+  // behind those with the same vruntime.
+  for(pp = &runq.head; *pp && (*pp)->vruntime <= p->vruntime; pp = &(*pp)->runnext)
+    ;
+  p->runnext = *pp;
+  *pp = p;
+  release(&runq.lock);
+}
+
+// Charge p for the time since it was switched to or last
+// charged, which it has spent in the kernel.
+// p->lock must be held.
+static void
+charge(struct proc *p)
+{
+  uint64 now = r_time();
+
+  p->stime += now - p->tstamp;
+  p->vruntime += (now - p->runstart) * NICE0WEIGHT / niceweight[p->nice - NICEMIN];
+  p->runstart = p->tstamp = now;
+}
+
+// Take the process for hart cpu off the run queue: the one with
+// the least vruntime of those allowed to run on cpu, or one not
+// far behind it that last ran on cpu.
+static struct proc*
+runqpop(int cpu)
+{
+  struct proc *p, **pp, **first = 0;
+
+  if(__atomic_load_n(&runq.head, __ATOMIC_RELAXED) == 0)
+    return 0;
+  acquire(&runq.lock);
+  for(pp = &runq.head; (p = *pp) != 0; pp = &p->runnext){
+    if((p->cpumask & (1L << cpu)) == 0)
+      continue;
+    if(first == 0)
+      first = pp;
+    else if(p->vruntime > (*first)->vruntime + CACHEHOT)
+      break;
+    if(p->lastcpu == cpu){
+      first = pp;
+      break;
+    }
+  }
+  if(first){
+    p = *first;
+    *first = p->runnext;
+    if(p->vruntime > runq.minvruntime)
+      runq.minvruntime = p->vruntime;
+  } else {
+    p = 0;
+  }
+  release(&runq.lock);
+  return p;
+}
+
 // Allocate a page for each process's kernel stack.
 // Map it high in memory, followed by an invalid
 // guard page.
@@ -51,8 +164,11 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  initlock(&runq.lock, "runq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
+      initlock(&p->fdlock, "fdtable");
+      initsleeplock(&vmlocks[p - proc], "vm");
       p->state = UNUSED;
       p->kstack = KSTACK((int) (p - proc));
   }
@@ -104,10 +220,11 @@ allocpid()
 
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
-// and return with p->lock held.
+// and return with p->lock held. If leader is not 0, the proc is
+// to be a thread sharing leader's memory, see clone().
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc*
-allocproc(void)
+allocproc(struct proc *leader)
 {
   struct proc *p;
 
@@ -124,7 +241,24 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->tracemask = 0;
+  // a child starts with its parent's share and harts, and no
+  // less vruntime than the running processes.
+  p->nice = myproc() ? myproc()->nice : 0;
+  p->vruntime = runq.minvruntime;
+  if(myproc() && myproc()->vruntime > p->vruntime)
+    p->vruntime = myproc()->vruntime;
+  p->cpumask = myproc() ? myproc()->cpumask : ~0L;
+  p->lastcpu = -1;
+  p->utime = p->stime = 0;
+  p->nvcsw = p->nivcsw = 0;
+  p->nmigrate = 0;
+  p->atuser = 0;
   p->state = USED;
+  p->nthreads = 1;
+  p->leader = leader;
+  p->tfva = leader ? THREADFRAME(p - proc) : TRAPFRAME;
+  fdinit(p);
+  vmainit(p);
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -142,8 +276,12 @@ found:
   p->usyscall->pid = p->pid;
   #endif
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
+  // An empty user page table. A thread uses its leader's,
+  // where clone() maps its trapframe.
+  if(leader)
+    p->pagetable = leader->pagetable;
+  else
+    p->pagetable = proc_pagetable(p);
   if(p->pagetable == 0){
     freeproc(p);
     release(&p->lock);
@@ -180,28 +318,39 @@ freeproc(struct proc *p)
   p->alarm_handler = 0;
   p->alarm_interval = 0;
   p->alarm_passed = 0;
+  fdfreetable(p);
 
-  // realse vma for mmap.
+  // realse vma for mmap. exit() has already unmapped them, so
+  // only a failed fork gets here with mappings, whose files the
+  // parent still holds open. A thread has none of its own: its
+  // memory is its leader's.
   int i;
   uint64 va;
   struct vma *vma;
-  for (i = 0; i < 16; i++) {
+  for (i = 0; i < p->nvma; i++) {
     vma = &p->vma[i];
-    if (vma->used) {
-      for (va = vma->vastart; va < vma->vaend; va += PGSIZE) {
-        pte_t *pte = walk(p->pagetable, va, 0);
-        if (pte && *pte & PTE_V) {
-          uvmunmap(p->pagetable, va, 1, 1);
-        }
-        vma->length -= PGSIZE;
+    for (va = vma->vastart; va < vma->vaend; va += PGSIZE) {
+      pte_t *pte = walk(p->pagetable, va, 0);
+      if (pte && *pte & PTE_V) {
+        uvmunmap(p->pagetable, va, 1, 1);
       }
-      vma->used = 0;
+    }
+    if (vma->f) {
+      fileclose(vma->f);
     }
   }
-  if(p->pagetable)
+  vmafreetable(p);
+  if(p->pagetable && p->leader == 0)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
+  p->leader = 0;
+  p->nthreads = 0;
+  p->tfva = 0;
+  p->asid = 0;
+  p->tlbstale = 0;
   p->sz = 0;
+  memset(&p->mem, 0, sizeof(p->mem));
+  memset(&p->ws, 0, sizeof(p->ws));
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
@@ -289,7 +438,7 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
   
   // allocate one user page and copy initcode's instructions
@@ -304,7 +453,7 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p, 0);
 
   release(&p->lock);
 }
@@ -315,13 +464,16 @@ int
 growproc(int n)
 {
   uint64 sz;
-  struct proc *p = myproc();
+  struct proc *p = leaderof(myproc());
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    // only reserve the address space; pagefault() allocates
+    // pages on first touch. Refuse to promise more than there
+    // is free memory and swap space right now.
+    if(sz + n > MMAPBASE || n > kfreemem() + swapspace())
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
@@ -334,39 +486,42 @@ growproc(int n)
 int
 fork(void)
 {
-  int i, pid;
+  int pid;
   struct proc *np;
   struct proc *p = myproc();
+  struct proc *mp = leaderof(p);
+
+  // the child gets a copy of the memory of the thread's process,
+  // which the other threads must leave alone meanwhile.
+  vmlock(p, 1);
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(0)) == 0){
+    vmunlock(p);
     return -1;
   }
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  if(uvmcopy(mp->pagetable, np->pagetable, mp->sz) < 0){
     freeproc(np);
     release(&np->lock);
+    vmunlock(p);
     return -1;
   }
-  np->sz = p->sz;
+  np->sz = mp->sz;
 
   // Copy mmap form parent to child.
-  uint64 va, pa;
-  for (i = 0; i < 16; i++) {
-    if (p->vma[i].used == 1) {
-        np->vma[i] = p->vma[i];
-        // filedup(np->vma[i].f);
-        for (va = np->vma[i].vastart; va < np->vma[i].vaend; va += PGSIZE) {
-          pte_t *pte = walk(p->pagetable, va, 0);
-          if (pte && *pte & PTE_V) {
-            pa = (uint64)PTE2PA(*pte);
-            mappages(np->pagetable, va, PGSIZE, (uint64)pa, PTE_FLAGS(*pte));
-            incmapcount((void*)pa, 1);
-          }
-        }
-    }
+  if(vmacopy(np, mp) < 0){
+    freeproc(np);
+    release(&np->lock);
+    vmunlock(p);
+    return -1;
   }
+  // the child maps the same pages; only its tables are its own.
+  np->mem = mp->mem;
+  uvmcount(np->pagetable, &np->mem, 0);
+  vmunlock(p);
+
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
 
@@ -374,10 +529,16 @@ fork(void)
   np->trapframe->a0 = 0;
 
   // increment reference counts on open file descriptors.
-  for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
+  if(fdcopy(np, p) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
   np->cwd = idup(p->cwd);
+  if(mp->textip)
+    np->textip = idup(mp->textip);
+  memmove(np->textseg, mp->textseg, sizeof(mp->textseg));
+  np->ntextseg = mp->ntextseg;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -390,13 +551,226 @@ fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
   np->tracemask = p->tracemask;
+  setrunnable(np, 0);
   release(&np->lock);
 
   return pid;
 }
 
+// Create a new process running the program at path with argv,
+// building its memory straight from the executable instead of
+// copying the parent's and then throwing the copy away, as fork()
+// followed by exec() would. The child's descriptor i is a dup of
+// the parent's fds[i] for i < nfd, or closed if fds[i] < 0, and
+// it has no others; if nfd < 0 it gets all the parent's.
+// Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, int *fds, int nfd)
+{
+  int i, argc, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  for(i = 0; i < nfd; i++){
+    if(fds[i] >= 0 && fdget(p, fds[i]) == 0)
+      return -1;
+  }
+
+  // Allocate process.
+  if((np = allocproc(0)) == 0){
+    return -1;
+  }
+  // exec() sleeps; np is not RUNNABLE, so nothing else runs it.
+  release(&np->lock);
+
+  if(nfd < 0){
+    if(fdcopy(np, p) < 0)
+      goto bad;
+  } else {
+    fdspawn(np, p, fds, nfd);
+  }
+
+  if((argc = execproc(np, path, argv)) < 0)
+    goto bad;
+  np->trapframe->a0 = argc;
+  np->cwd = idup(p->cwd);
+  np->tracemask = p->tracemask;
+
+  pid = np->pid;
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  setrunnable(np, 0);
+  release(&np->lock);
+
+  return pid;
+
+ bad:
+  fdcloseall(np);
+  acquire(&np->lock);
+  freeproc(np);
+  release(&np->lock);
+  return -1;
+}
+
+// Threads.
+//
+// clone() makes a thread: a proc with its own kernel stack and
+// trapframe, but with the memory, mmap() regions and open files of
+// the process that made it, its leader. The thread's p->pagetable
+// is the leader's, with the thread's trapframe mapped at a
+// THREADFRAME of its own; p->sz, the regions and the descriptor
+// table are only the leader's, and what uses them goes through
+// leaderof(). Threads are otherwise processes: each has a pid, is
+// scheduled on its own, and is reaped by its parent's wait().
+//
+// Threads that run at once on several harts fault, grow and map
+// memory in one page table, which they serialize with vmlock(),
+// and harts that may cache its translations are told of changes
+// to it by tlbshootdown() in vm.c. The swap, merging and
+// working-set scanners leave threaded processes alone, since they
+// change page tables without such precautions.
+//
+// A thread's exit() leaves the process's memory and files to the
+// leader. The leader's exit() or exec() kills the threads, and
+// waits for them to leave, before tearing the memory down.
+
+// The process whose memory and files p uses: p's leader if p is
+// a thread, else p itself.
+struct proc*
+leaderof(struct proc *p)
+{
+  if(p && p->leader)
+    return p->leader;
+  return p;
+}
+
+// Is p a thread, or a process with threads?
+int
+threaded(struct proc *p)
+{
+  return p->leader != 0 || p->nthreads > 1;
+}
+
+// May the swap and merging scanners change p's page table and
+// free the pages it maps? Only if p is not running and stopped
+// between system calls and faults, where it was preempted from
+// user space (see usertrap()); anywhere else in the kernel it may
+// hold one of its PTEs, or the address of one of its pages.
+// Caller holds p->lock.
+int
+pagetableidle(struct proc *p)
+{
+  return !threaded(p) && p->state == RUNNABLE && p->atuser;
+}
+
+// Lock the memory that p shares with other threads, for a page
+// fault or a change of mappings. vmlock comes before every other
+// lock. A process without threads needs no lock. If wait is 0,
+// returns -1 rather than sleep for the lock.
+int
+vmlock(struct proc *p, int wait)
+{
+  struct proc *mp = leaderof(p);
+  struct sleeplock *lk = &vmlocks[mp - proc];
+
+  if(mp->nthreads == 1)
+    return 0;
+  if(wait)
+    acquiresleep(lk);
+  else if(!tryacquiresleep(lk))
+    return -1;
+  return 0;
+}
+
+void
+vmunlock(struct proc *p)
+{
+  struct sleeplock *lk = &vmlocks[leaderof(p) - proc];
+
+  if(holdingsleep(lk))
+    releasesleep(lk);
+}
+
+// Create a thread of the current process, to run fn(arg) in user
+// space with its stack pointer at stack. Returns its pid, or -1.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int pid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct proc *mp = leaderof(p);
+
+  if((np = allocproc(mp)) == 0){
+    return -1;
+  }
+  // mapping the trapframe may sleep; np is not RUNNABLE, so
+  // nothing else runs it.
+  release(&np->lock);
+
+  vmlock(p, 1);
+  if(mappages(mp->pagetable, np->tfva, PGSIZE,
+              (uint64)np->trapframe, PTE_R | PTE_W) < 0){
+    vmunlock(p);
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  vmunlock(p);
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->a0 = arg;
+  np->trapframe->sp = stack;
+  np->cwd = idup(p->cwd);
+  np->tracemask = p->tracemask;
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  pid = np->pid;
+
+  acquire(&wait_lock);
+  np->parent = p;
+  mp->nthreads++;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  setrunnable(np, 0);
+  release(&np->lock);
+
+  return pid;
+}
+
+// Kill p's threads and wait until they have left its memory,
+// for exit() and exec(), which are about to tear it down.
+void
+killthreads(struct proc *p)
+{
+  struct proc *t;
+
+  acquire(&wait_lock);
+  while(p->nthreads > 1){
+    for(t = proc; t < &proc[NPROC]; t++){
+      if(t->leader == p){
+        acquire(&t->lock);
+        t->killed = 1;
+        if(t->state == SLEEPING)
+          setrunnable(t, 1);
+        release(&t->lock);
+      }
+    }
+    // each thread that leaves wakes us; one might have made
+    // another meanwhile.
+    sleep(&p->nthreads, &wait_lock);
+  }
+  release(&wait_lock);
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
@@ -423,22 +797,39 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
+  if(p->leader){
+    // the memory and files are the leader's; only the
+    // trapframe's mapping is the thread's own.
+    vmlock(p, 1);
+    uvmunmap(p->pagetable, p->tfva, 1, 0);
+    vmunlock(p);
+  } else {
+    killthreads(p);
+
+    // Write back and drop mmap()ed files.
+    vmacloseall(p);
+
+    // Close all open files.
+    fdcloseall(p);
   }
 
   begin_op();
   iput(p->cwd);
+  if(p->textip)
+    iput(p->textip);
   end_op();
   p->cwd = 0;
+  p->textip = 0;
+  p->ntextseg = 0;
 
   acquire(&wait_lock);
 
+  // The leader might be waiting in killthreads().
+  if(p->leader){
+    p->leader->nthreads--;
+    wakeup(&p->leader->nthreads);
+  }
+
   // Give any children to init.
   reparent(p);
 
@@ -466,6 +857,10 @@ wait(uint64 addr)
   int havekids, pid;
   struct proc *p = myproc();
 
+  // the status is copied out with wait_lock held.
+  if(addr != 0)
+    uvmprefault(addr, sizeof(int), 1);
+
   acquire(&wait_lock);
 
   for(;;){
@@ -509,10 +904,12 @@ wait(uint64 addr)
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run: the one at the head of the
+//    run queue, which has had the least CPU for its weight.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
+//  - charge it for the time it ran.
 void
 scheduler(void)
 {
@@ -520,26 +917,51 @@ scheduler(void)
   struct cpu *c = mycpu();
   
   c->proc = 0;
+  __sync_fetch_and_or(&online, 1L << cpuid());
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+    if((p = runqpop(cpuid())) == 0){
+      // nothing to run: stop the clock tick, keep ticks up
+      // to date without it, and use the time to merge pages.
+      hrtick(0);
+      clockupdate();
+      ksmidle();
+      wsssample();
+      continue;
     }
+
+    // a process that yield()ed is still on its hart's stack
+    // until that hart's scheduler lets go of p->lock.
+    acquire(&p->lock);
+    if(p->state == RUNNABLE) {
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      p->state = RUNNING;
+      c->proc = p;
+      if(p->lastcpu >= 0 && p->lastcpu != cpuid())
+        p->nmigrate++;
+      p->lastcpu = cpuid();
+      // the clock tick preempts it.
+      hrtick(1);
+      // this hart may cache p's translations now, see
+      // tlbshootdown() in vm.c.
+      __sync_fetch_and_or(&leaderof(p)->oncpu, 1L << cpuid());
+      p->runstart = p->tstamp = r_time();
+      swtch(&c->context, &p->context);
+      __sync_fetch_and_and(&leaderof(p)->oncpu, ~(1L << cpuid()));
+
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      // yield() charged it before putting it back on the queue.
+      if(p->state != RUNNABLE)
+        charge(p);
+      c->proc = 0;
+    }
+    release(&p->lock);
+    wsssample();
   }
 }
 
@@ -576,7 +998,9 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  p->nivcsw++;
+  charge(p);
+  setrunnable(p, 0);
   sched();
   release(&p->lock);
 }
@@ -622,6 +1046,7 @@ sleep(void *chan, struct spinlock *lk)
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->nvcsw++;
 
   sched();
 
@@ -644,7 +1069,7 @@ wakeup(void *chan)
     if(p != myproc()){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+        setrunnable(p, 1);
       }
       release(&p->lock);
     }
@@ -665,7 +1090,7 @@ kill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        setrunnable(p, 1);
       }
       release(&p->lock);
       return 0;
@@ -750,6 +1175,10 @@ procdump(void)
     else
       state = "???";
     printf("%d %s %s", p->pid, state, p->name);
+    printf(" nice %d user %dms sys %dms csw %d/%d", p->nice,
+           (int)(p->utime * NSPERTIME / 1000000), (int)(p->stime * NSPERTIME / 1000000),
+           (int)p->nvcsw, (int)p->nivcsw);
+    printf(" cpu %d mask %x mig %d", p->lastcpu, (int)p->cpumask, (int)p->nmigrate);
     printf("\n");
   }
 }
@@ -766,4 +1195,98 @@ procnums(void) {
   }
   
   return count;
+}
+
+// Copy the CPU use of process pid, or return -1 if there is no
+// such process.
+int
+proccpustat(int pid, struct cpustat *st)
+{
+  struct proc *p;
+
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      st->nice = p->nice;
+      st->utime = p->utime;
+      st->stime = p->stime;
+      st->vruntime = p->vruntime;
+      st->nvcsw = p->nvcsw;
+      st->nivcsw = p->nivcsw;
+      st->cpumask = p->cpumask;
+      st->lastcpu = p->lastcpu;
+      st->nmigrate = p->nmigrate;
+      release(&p->lock);
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Set the nice value of process pid. It takes effect as the
+// process is next charged for CPU time.
+int
+setnice(int pid, int nice)
+{
+  struct proc *p;
+
+  if(nice < NICEMIN || nice > NICEMAX)
+    return -1;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED && p->state != ZOMBIE){
+      p->nice = nice;
+      release(&p->lock);
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Let process pid run only on the harts in mask, of those that
+// are running. It moves off any other hart the next time it gives
+// one up.
+int
+setaffinity(int pid, uint64 mask)
+{
+  struct proc *p;
+
+  if((mask & online) == 0)
+    return -1;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED && p->state != ZOMBIE){
+      acquire(&runq.lock);
+      p->cpumask = mask & online;
+      release(&runq.lock);
+      release(&p->lock);
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Copy the memory use and working set of process pid, or return
+// -1 if there is no such process.
+int
+procmemuse(int pid, struct memuse *m, struct wsinfo *ws)
+{
+  struct proc *p, *mp;
+
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      // a live thread's memory is its leader's.
+      mp = p->state == ZOMBIE ? p : leaderof(p);
+      *m = mp->mem;
+      *ws = mp->ws;
+      release(&p->lock);
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
 }
\ No newline at end of file
@@ -24,6 +24,9 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation the TLB has been flushed for
+  uint tlbreq;                // TLB flushes other harts have asked for
+  uint tlback;                // and the last one done, see tlbshootdown()
 };
 
 extern struct cpu cpus[NCPU];
@@ -81,17 +84,43 @@ struct trapframe {
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
-// (va - vma.start) / PGSIZE + vma.offset is the actual offset of a file.
+// A mapped region [vastart, vaend) of a process, see vma.c.
+// va - vastart + offset is the offset in the file.
 struct vma {
   uint64 vastart;
-  uint64 vaend;
-  int length;
-  int offset;
-  struct file *f;
-  int used;
-  int mode;
-  struct inode *ip;
-  int flags;
+  uint64 vaend;     // page aligned
+  uint offset;
+  int mode;         // PROT_*
+  int flags;        // MAP_*
+  int advice;       // MADV_*, how to fault-around
+  struct file *f;   // 0 for anonymous memory
+  struct inode *ip; // f->ip
+};
+
+// A read-only program segment that exec() left unmapped,
+// to be mapped from the page cache on first touch.
+struct textseg {
+  uint64 va;    // first virtual address, page-aligned
+  uint64 end;   // end of the demand-paged part
+  uint off;     // file offset of va, page-aligned
+  int perm;     // PTE permissions
+};
+
+#define NTEXTSEG 2
+
+// A process's memory, in pages; see memstat().
+struct memuse {
+  int rss;        // user pages mapped
+  int rssmmap;    // of which mmap()ed
+  int swapped;    // user pages on swap
+  int npt;        // page-table pages
+};
+
+// A process's resident pages by age, as the working-set sampler
+// last saw them; see wss.c.
+struct wsinfo {
+  int hist[NWSSHIST];   // by periods since last use, in powers of 2
+  int size;             // used in the last WSSWINDOW periods
 };
 
 // Per-process state
@@ -104,26 +133,63 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int nice;                    // -20 (most CPU) to 19 (least)
+  uint64 vruntime;             // CPU time, scaled by weight; see scheduler()
+  struct proc *runnext;        // In the run queue, if RUNNABLE
+  uint64 cpumask;              // Harts it may run on; runq.lock too to set
+  int lastcpu;                 // Hart it last ran on, or -1
 
-  // wait_lock must be held when using this:
+  // wait_lock must be held when using these:
   struct proc *parent;         // Parent process
+  int nthreads;                // Threads using this process's memory, itself included
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
+  uint64 asid;                 // ASID generation and number, see vm.c
+  uint64 tlbstale;             // Harts that may hold stale entries for asid
+  uint64 oncpu;                // Harts running one of its threads
+  struct proc *leader;         // Process whose memory and files a thread shares, or 0
   struct trapframe *trapframe; // data page for trampoline.S
+  uint64 tfva;                 // Where trapframe is mapped in pagetable
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
+  struct file **ofile;         // Open files, nofile entries
+  int nofile;                  // Capacity of ofile
+  int fdfree;                  // No free descriptor below this one
+  uint64 fdmap[NOFILEMAX/64];  // Bitmap of descriptors in use
+  struct file *ofile0[NOFILE]; // Initial open-file table
+  struct spinlock fdlock;      // Protects the table while threads share it
+  struct file *fdheld;         // Reference fdhold() keeps for this system call
   struct inode *cwd;           // Current directory
+  struct inode *textip;        // Executable backing textseg
+  struct textseg textseg[NTEXTSEG]; // Demand-paged program text
+  int ntextseg;
   char name[16];               // Process name (debugging)
-  int tracemask;               // Trace mask
+  uint64 tracemask;            // Trace mask: bit n for SYS_ number n
+  struct memuse mem;           // Memory use, kept by vm.c and swap.c
+  struct wsinfo ws;            // Working set, kept by wss.c
+  int nsleeplock;              // Sleep locks held
+  int atuser;                  // Stopped on its way back to user space
+
+  // CPU accounting, in ticks of the time register; kept by the
+  // hart running the process.
+  uint64 utime;                // In user space
+  uint64 stime;                // In the kernel
+  uint64 tstamp;               // When utime or stime last grew
+  uint64 runstart;             // When it was last switched to
+  uint64 nvcsw;                // Times it gave up the CPU to sleep
+  uint64 nivcsw;               // and was preempted
+  uint64 nmigrate;             // Times it ran on another hart than last
   
   #ifdef LAB_PGTBL
   struct usyscall *usyscall;
   #endif
 
-  struct vma vma[16];
+  struct vma *vma;             // Mapped regions, sorted by address
+  int nvma;
+  int maxvma;                  // Capacity of vma
+  struct vma vma0[NVMA];       // Initial region array
   struct trapframe *trapframeepc;
   int alarm_interval;
   int alarm_passed;
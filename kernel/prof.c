@@ -0,0 +1,180 @@
+// Sampling profiler.
+//
+// Writing an int n to the prof device starts the profiler at n
+// samples per clock tick, and 0 stops it. While it runs, each busy
+// hart's periodic tick (see hrtimer.c) comes n times as often;
+// devintr() turns every n-th one into a clock tick, and the trap
+// handlers hand all of them to profsample(). Idle harts take no
+// ticks, and so no samples. A sample is where the hart was, user or
+// kernel, which process it was running, and the return addresses
+// of the frame pointer chain above it.
+//
+// Each hart keeps its samples in a ring of its own, which only its
+// interrupt handler adds to and only readers of the device take
+// from. A sample that finds the ring full is dropped. A read waits
+// for samples while the profiler runs, and returns 0 once it has
+// stopped and the rings are empty. user/prof.c reads them.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "prof.h"
+#include "defs.h"
+
+#define NPROFRING 512   // samples per hart; a power of 2
+#define MAXRATE   100   // samples per clock tick
+
+extern uint ticks;
+
+struct ring {
+  uint head;            // next sample to add; only the hart writes it
+  uint tail;            // next sample to read
+  uint nlost;           // samples dropped with the ring full
+  int nintr;            // timer interrupts since the last clock tick
+  struct sample s[NPROFRING];
+};
+
+static struct {
+  struct spinlock lock; // serializes readers
+  int rate;             // samples per clock tick, 0 if stopped
+  struct ring ring[NCPU];
+} prof;
+
+// Called for each periodic tick. Returns 1 if it is also a
+// clock tick.
+int
+proftick(void)
+{
+  struct ring *r = &prof.ring[cpuid()];
+  int rate = prof.rate;
+
+  if(rate == 0)
+    return 1;
+  if(++r->nintr < rate)
+    return 0;
+  r->nintr = 0;
+  return 1;
+}
+
+// Take a sample of a timer interrupt, from user code if user is
+// set, at pc, with frame pointer fp. Interrupts are off.
+void
+profsample(int user, uint64 pc, uint64 fp)
+{
+  struct ring *r = &prof.ring[cpuid()];
+  struct proc *p = myproc();
+  struct sample *s;
+
+  if(prof.rate == 0)
+    return;
+  if(r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == NPROFRING){
+    r->nlost++;
+    return;
+  }
+  s = &r->s[r->head % NPROFRING];
+  s->pc = pc;
+  s->user = user;
+  s->cpu = cpuid();
+  s->pid = p ? p->pid : 0;
+  safestrcpy(s->name, p ? p->name : "", sizeof(s->name));
+  if(user)
+    s->ntrace = usertrace(p->pagetable, fp, s->trace, NPROFTRACE);
+  else if(PGROUNDDOWN(fp) == PGROUNDDOWN(r_sp()))
+    s->ntrace = tracefrom(fp, s->trace, NPROFTRACE);
+  else
+    s->ntrace = 0;  // not a frame on this stack
+  __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+// Take the oldest sample of some hart's ring into s.
+// Returns 0 if there are none.
+static int
+take(struct sample *s)
+{
+  struct ring *r;
+  int found = 0;
+
+  acquire(&prof.lock);
+  for(r = prof.ring; r < &prof.ring[NCPU]; r++){
+    if(r->tail != __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)){
+      *s = r->s[r->tail % NPROFRING];
+      __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+      found = 1;
+      break;
+    }
+  }
+  release(&prof.lock);
+  return found;
+}
+
+int
+profread(int user_dst, uint64 dst, int n)
+{
+  struct sample s;
+  int tot = 0;
+  uint ticks0;
+
+  while(n - tot >= sizeof(s)){
+    if(!take(&s)){
+      if(tot > 0 || prof.rate == 0)
+        break;
+      // wait a tick for more.
+      acquire(&tickslock);
+      ticks0 = ticks;
+      while(ticks == ticks0){
+        if(killed(myproc())){
+          release(&tickslock);
+          return -1;
+        }
+        sleep(&ticks, &tickslock);
+      }
+      release(&tickslock);
+      continue;
+    }
+    if(either_copyout(user_dst, dst + tot, &s, sizeof(s)) < 0)
+      return -1;
+    tot += sizeof(s);
+  }
+  return tot;
+}
+
+// Set the rate, in samples per clock tick.
+int
+profwrite(int user_src, uint64 src, int n)
+{
+  int rate;
+
+  if(n != sizeof(rate) || either_copyin(&rate, user_src, src, sizeof(rate)) < 0)
+    return -1;
+  if(rate < 0 || rate > MAXRATE)
+    return -1;
+  prof.rate = rate;
+  hrinterval(TICKINTERVAL / (rate ? rate : 1));
+  return n;
+}
+
+// Print the samples the rings dropped into buf, for the
+// statistics device.
+int
+statsprof(char *buf, int sz)
+{
+  int i, nlost = 0;
+
+  for(i = 0; i < NCPU; i++)
+    nlost += prof.ring[i].nlost;
+  return snprintf(buf, sz, "prof: %d samples per tick, %d lost\n", prof.rate, nlost);
+}
+
+void
+profinit(void)
+{
+  initlock(&prof.lock, "prof");
+  devsw[PROF].read = profread;
+  devsw[PROF].write = profwrite;
+}
@@ -0,0 +1,13 @@
+// A sample taken by the profiler, as read from the prof device.
+#define NPROFTRACE 6   // return addresses kept per sample
+
+struct sample {
+  uint64 pc;                  // where the hart was
+  uint64 trace[NPROFTRACE];   // return addresses of its callers
+  int pid;                    // 0 if no process was running
+  char user;                  // pc and trace are user addresses
+  char ntrace;                // entries of trace in use
+  char cpu;
+  char pad;
+  char name[16];              // of the process, for its symbols
+};
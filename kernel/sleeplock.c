@@ -9,37 +9,180 @@
 #include "proc.h"
 #include "sleeplock.h"
 
+#define SPINMAX 1000  // ticks of the time register to spin for, at most
+
+// how an acquisition waited, see sleepwait().
+enum { FREE, SPUN, SLEPT };
+
+static struct {
+  uint64 n[3];   // acquisitions, by how they waited
+} sleepstat;
+
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->readers = 0;
+  lk->writers = 0;
   lk->pid = 0;
+  lk->owner = 0;
+  lk->sleepers = 0;
+  lk->site = -1;
+}
+
+// Wait for lk to change hands. While an exclusive holder runs on
+// another hart it is likely to release lk sooner than a sleep and
+// a wakeup would take, so spin instead, for up to SPINMAX. Called
+// and returns with lk->lk held. Raises *how to what it did.
+static void
+sleepwait(struct sleeplock *lk, int *how)
+{
+  struct proc *owner = lk->owner;
+  uint64 start;
+
+  if(owner && owner->state == RUNNING){
+    if(*how < SPUN)
+      *how = SPUN;
+    release(&lk->lk);
+    start = r_time();
+    while(__atomic_load_n(&lk->owner, __ATOMIC_RELAXED) == owner &&
+          __atomic_load_n(&owner->state, __ATOMIC_RELAXED) == RUNNING &&
+          r_time() - start < SPINMAX)
+      ;
+    acquire(&lk->lk);
+    if(lk->owner != owner)
+      return;
+  }
+  *how = SLEPT;
+  lk->sleepers++;
+  sleep(lk, &lk->lk);
+  lk->sleepers--;
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
+  uint64 start = r_time();
+  int how = FREE;
+
   acquire(&lk->lk);
-  while (lk->locked) {
-    sleep(lk, &lk->lk);
-  }
+  lk->writers++;
+  while (lk->locked || lk->readers)
+    sleepwait(lk, &how);
+  lk->writers--;
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  lk->owner = myproc();
+  myproc()->nsleeplock++;
+  __sync_fetch_and_add(&sleepstat.n[how], 1);
+  lk->site = lockacquired(lk->name, (uint64)__builtin_return_address(0),
+                          1, start, how != FREE);
+  lk->start = r_time();
+  release(&lk->lk);
+}
+
+// Take lk if it is free, without sleeping.
+// Returns 1 if it did, 0 if someone else holds it.
+int
+tryacquiresleep(struct sleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = lk->locked == 0 && lk->readers == 0;
+  if(r){
+    lk->locked = 1;
+    lk->pid = myproc()->pid;
+    lk->owner = myproc();
+    myproc()->nsleeplock++;
+    lk->site = lockacquired(lk->name, (uint64)__builtin_return_address(0),
+                            1, 0, 0);
+    lk->start = r_time();
+  }
   release(&lk->lk);
+  return r;
 }
 
 void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+  lockreleased(lk->site, lk->start);
   lk->locked = 0;
   lk->pid = 0;
-  wakeup(lk);
+  lk->owner = 0;
+  myproc()->nsleeplock--;
+  if(lk->sleepers)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
+// Hold lk shared, with other processes that only read what it
+// protects. Waits while a process holds it exclusively, or waits
+// to, so that a stream of readers cannot starve a writer.
+// Shared holds are not charged hold times by the lock profiler,
+// there being no one place to keep their start.
+void
+acquiresleepshared(struct sleeplock *lk)
+{
+  uint64 start = r_time();
+  int how = FREE;
+
+  acquire(&lk->lk);
+  while (lk->locked || lk->writers)
+    sleepwait(lk, &how);
+  lk->readers++;
+  myproc()->nsleeplock++;
+  __sync_fetch_and_add(&sleepstat.n[how], 1);
+  lockacquired(lk->name, (uint64)__builtin_return_address(0),
+               1, start, how != FREE);
   release(&lk->lk);
 }
 
+void
+releasesleepshared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(lk->readers < 1)
+    panic("releasesleepshared");
+  lk->readers--;
+  myproc()->nsleeplock--;
+  if(lk->readers == 0 && lk->sleepers)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
+// Turn an exclusive hold of lk into a shared one, letting
+// other readers in.
+void
+downgradesleep(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  lockreleased(lk->site, lk->start);
+  lk->locked = 0;
+  lk->pid = 0;
+  lk->owner = 0;
+  lk->readers++;
+  if(lk->sleepers)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
+// Does some process hold lk shared? The lock does not record
+// which ones do.
+int
+holdingsleepshared(struct sleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = lk->readers > 0;
+  release(&lk->lk);
+  return r;
+}
+
 int
 holdingsleep(struct sleeplock *lk)
 {
@@ -51,5 +194,11 @@ holdingsleep(struct sleeplock *lk)
   return r;
 }
 
-
-
+// Print how sleeplock acquisitions waited into buf, for the
+// statistics device.
+int
+statssleep(char *buf, int sz)
+{
+  return snprintf(buf, sz, "sleeplock: %ld acquired at once, %ld after spinning, %ld after sleeping\n",
+                  sleepstat.n[FREE], sleepstat.n[SPUN], sleepstat.n[SLEPT]);
+}
@@ -1,10 +1,20 @@
-// Long-term locks for processes
+// Long-term locks for processes.
+// Held either by one process (exclusive) or by any number of
+// processes at once (shared), see acquiresleepshared().
 struct sleeplock {
-  uint locked;       // Is the lock held?
+  uint locked;       // Is the lock held exclusively?
+  int readers;       // Processes holding it shared
+  int writers;       // Processes waiting to hold it exclusively
   struct spinlock lk; // spinlock protecting this sleep lock
   
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+  struct proc *owner; // and the process itself, for acquiresleep()
+  int sleepers;      // Processes asleep waiting for it
+
+  // For profiling, see lockstat.c:
+  int site;          // Where the holder acquired it,
+  uint64 start;      // and when.
 };
 
@@ -43,12 +43,120 @@ findslot(struct spinlock *lk) {
 }
 #endif
 
+#if defined(SPINLOCK_TICKET)
+#define BACKOFF 32  // delay loop iterations per waiter ahead
+
+// Take a ticket and wait for it to come up. Waiters only read
+// owner while they wait, and back off in proportion to their place
+// in line, so that fewer of them reload it each time it changes.
+// Returns 1 if it had to wait.
+static int
+ticketacquire(struct spinlock *lk)
+{
+  uint t, o;
+  int waited = 0;
+
+  t = __sync_fetch_and_add(&lk->next, 1);
+  while((o = __atomic_load_n(&lk->owner, __ATOMIC_ACQUIRE)) != t) {
+    waited = 1;
+#ifdef LAB_LOCK
+    __sync_fetch_and_add(&(lk->nts), 1);
+#endif
+    tlbservice();
+    for(int i = (t - o - 1) * BACKOFF; i > 0; i--)
+      asm volatile("nop");
+  }
+  return waited;
+}
+
+static void
+ticketrelease(struct spinlock *lk)
+{
+  // only the holder writes owner.
+  __atomic_store_n(&lk->owner, lk->owner + 1, __ATOMIC_RELEASE);
+}
+#endif
+
+#if defined(SPINLOCK_MCS)
+#define NMCS 8      // spinlocks a cpu can hold or wait for at once
+
+// A waiter's place in an MCS lock's queue. Each waiter spins on
+// its own node, in its own cache line, until the waiter ahead of
+// it hands the lock over.
+struct mcsnode {
+  struct mcsnode *next;
+  int wait;
+  int busy;         // in some lock's queue
+} __attribute__((aligned(64)));
+
+static struct mcsnode mcsnodes[NCPU][NMCS];
+
+static int
+mcsacquire(struct spinlock *lk)
+{
+  struct mcsnode *n, *prev;
+  int waited = 0;
+
+  // interrupts are off, so nothing else on this cpu picks a node.
+  for(n = mcsnodes[cpuid()]; n < &mcsnodes[cpuid()][NMCS]; n++)
+    if(!n->busy)
+      break;
+  if(n == &mcsnodes[cpuid()][NMCS])
+    panic("mcsacquire");
+  n->busy = 1;
+  n->next = 0;
+  n->wait = 1;
+
+  prev = __atomic_exchange_n(&lk->tail, n, __ATOMIC_ACQ_REL);
+  if(prev) {
+    __atomic_store_n(&prev->next, n, __ATOMIC_RELEASE);
+    while(__atomic_load_n(&n->wait, __ATOMIC_ACQUIRE)) {
+      waited = 1;
+#ifdef LAB_LOCK
+      __sync_fetch_and_add(&(lk->nts), 1);
+#endif
+      tlbservice();
+    }
+  }
+  lk->node = n;
+  return waited;
+}
+
+static void
+mcsrelease(struct spinlock *lk)
+{
+  struct mcsnode *n = lk->node, *next;
+
+  lk->node = 0;
+  if((next = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE)) == 0) {
+    if(__sync_bool_compare_and_swap(&lk->tail, n, 0)) {
+      n->busy = 0;
+      return;
+    }
+    // a waiter has queued itself but not yet linked to n.
+    while((next = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE)) == 0)
+      ;
+  }
+  __atomic_store_n(&next->wait, 0, __ATOMIC_RELEASE);
+  n->busy = 0;
+}
+#endif
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
+#if defined(SPINLOCK_TICKET)
+  lk->next = 0;
+  lk->owner = 0;
+#elif defined(SPINLOCK_MCS)
+  lk->tail = 0;
+  lk->node = 0;
+#else
   lk->locked = 0;
+#endif
   lk->cpu = 0;
+  lk->site = -1;
 #ifdef LAB_LOCK
   lk->nts = 0;
   lk->n = 0;
@@ -61,6 +169,9 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint64 start;
+  int waited = 0;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
@@ -69,17 +180,25 @@ acquire(struct spinlock *lk)
     __sync_fetch_and_add(&(lk->n), 1);
 #endif  
 
+  start = r_time();
+#if defined(SPINLOCK_TICKET)
+  waited = ticketacquire(lk);
+#elif defined(SPINLOCK_MCS)
+  waited = mcsacquire(lk);
+#else
   // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
   while(__sync_lock_test_and_set(&lk->locked, 1) != 0) {
+    waited = 1;
 #ifdef LAB_LOCK
     __sync_fetch_and_add(&(lk->nts), 1);
-#else
-   ;
 #endif
+    // the holder may be waiting for this hart to flush its TLB.
+    tlbservice();
   }
+#endif
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -89,6 +208,9 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+  lk->site = lockacquired(lk->name, (uint64)__builtin_return_address(0),
+                          0, start, waited);
+  lk->start = r_time();
 }
 
 // Release the lock.
@@ -98,6 +220,7 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+  lockreleased(lk->site, lk->start);
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -108,6 +231,11 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
+#if defined(SPINLOCK_TICKET)
+  ticketrelease(lk);
+#elif defined(SPINLOCK_MCS)
+  mcsrelease(lk);
+#else
   // Release the lock, equivalent to lk->locked = 0.
   // This code doesn't use a C assignment, since the C standard
   // implies that an assignment might be implemented with
@@ -116,6 +244,7 @@ release(struct spinlock *lk)
   //   s1 = &lk->locked
   //   amoswap.w zero, zero, (s1)
   __sync_lock_release(&lk->locked);
+#endif
 
   pop_off();
 }
@@ -126,7 +255,13 @@ int
 holding(struct spinlock *lk)
 {
   int r;
+#if defined(SPINLOCK_TICKET)
+  r = (lk->owner != lk->next && lk->cpu == mycpu());
+#elif defined(SPINLOCK_MCS)
+  r = (lk->tail != 0 && lk->cpu == mycpu());
+#else
   r = (lk->locked && lk->cpu == mycpu());
+#endif
   return r;
 }
 
@@ -1,10 +1,26 @@
 // Mutual exclusion lock.
+//
+// Waiters spin on a test-and-set word unless the kernel is built
+// with SPINLOCK=ticket or SPINLOCK=mcs, which make them queue and
+// take the lock in the order they asked for it.
 struct spinlock {
+#if defined(SPINLOCK_TICKET)
+  uint next;         // Next ticket to hand out.
+  uint owner;        // Ticket that holds the lock.
+#elif defined(SPINLOCK_MCS)
+  struct mcsnode *tail;  // Last in the queue, or 0 if the lock is free.
+  struct mcsnode *node;  // The holder's place in the queue.
+#else
   uint locked;       // Is the lock held?
+#endif
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For profiling, see lockstat.c:
+  int site;          // Where the holder acquired it,
+  uint64 start;      // and when.
 #ifdef LAB_LOCK
   int nts;
   int n;
@@ -19,11 +19,11 @@ sputc(char *s, char c)
 }
 
 static int
-sprintint(char *s, int xx, int base, int sign)
+sprintint(char *s, long xx, int base, int sign)
 {
-  char buf[16];
+  char buf[24];
   int i, n;
-  uint x;
+  uint64 x;
 
   if(sign && (sign = xx < 0))
     x = -xx;
@@ -44,6 +44,18 @@ sprintint(char *s, int xx, int base, int sign)
   return n;
 }
 
+static int
+sprintptr(char *s, uint64 x)
+{
+  int i, n;
+
+  n = sputc(s, '0');
+  n += sputc(s+n, 'x');
+  for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
+    n += sputc(s+n, digits[x >> (sizeof(uint64) * 8 - 4)]);
+  return n;
+}
+
 int
 snprintf(char *buf, int sz, char *fmt, ...)
 {
@@ -71,6 +83,18 @@ snprintf(char *buf, int sz, char *fmt, ...)
     case 'x':
       off += sprintint(buf+off, va_arg(ap, int), 16, 1);
       break;
+    case 'l':
+      // %ld and %lx, of a 64-bit number.
+      if((c = fmt[++i] & 0xff) == 'd')
+        off += sprintint(buf+off, va_arg(ap, uint64), 10, 1);
+      else if(c == 'x')
+        off += sprintint(buf+off, va_arg(ap, uint64), 16, 0);
+      else if(c == 0)
+        i--;
+      break;
+    case 'p':
+      off += sprintptr(buf+off, va_arg(ap, uint64));
+      break;
     case 's':
       if((s = va_arg(ap, char*)) == 0)
         s = "(null)";
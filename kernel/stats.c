@@ -9,9 +9,11 @@
 #include "riscv.h"
 #include "defs.h"
 
-#define BUFSZ 4096
+#define BUFSZ (64*1024)
+// lock is a sleep lock: the copy out to the reader can fault,
+// and paging in from swap sleeps.
 static struct {
-  struct spinlock lock;
+  struct sleeplock lock;
   char buf[BUFSZ];
   int sz;
   int off;
@@ -20,10 +22,12 @@ static struct {
 int statscopyin(char*, int);
 int statslock(char*, int);
   
+// Any write clears the lock profile.
 int
 statswrite(int user_src, uint64 src, int n)
 {
-  return -1;
+  lockstatreset();
+  return n;
 }
 
 int
@@ -31,7 +35,7 @@ statsread(int user_dst, uint64 dst, int n)
 {
   int m;
 
-  acquire(&stats.lock);
+  acquiresleep(&stats.lock);
 
   if(stats.sz == 0) {
 #ifdef LAB_PGTBL
@@ -40,6 +44,13 @@ statsread(int user_dst, uint64 dst, int n)
 #ifdef LAB_LOCK
     stats.sz = statslock(stats.buf, BUFSZ);
 #endif
+    stats.sz += statsswap(stats.buf + stats.sz, BUFSZ - stats.sz);
+    stats.sz += statsksm(stats.buf + stats.sz, BUFSZ - stats.sz);
+    stats.sz += statswss(stats.buf + stats.sz, BUFSZ - stats.sz);
+    stats.sz += statsprof(stats.buf + stats.sz, BUFSZ - stats.sz);
+    stats.sz += statssystrace(stats.buf + stats.sz, BUFSZ - stats.sz);
+    stats.sz += statssleep(stats.buf + stats.sz, BUFSZ - stats.sz);
+    stats.sz += statslockstat(stats.buf + stats.sz, BUFSZ - stats.sz);
   }
   m = stats.sz - stats.off;
 
@@ -54,14 +65,14 @@ statsread(int user_dst, uint64 dst, int n)
     stats.sz = 0;
     stats.off = 0;
   }
-  release(&stats.lock);
+  releasesleep(&stats.lock);
   return m;
 }
 
 void
 statsinit(void)
 {
-  initlock(&stats.lock, "stats");
+  initsleeplock(&stats.lock, "stats");
 
   devsw[STATS].read = statsread;
   devsw[STATS].write = statswrite;
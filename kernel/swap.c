@@ -0,0 +1,460 @@
+// Swap space.
+//
+// When free memory runs low, pagefault() calls swapreserve(), which
+// pushes cold anonymous user pages out to a swap area on the disk
+// after the file system (see mkfs). A swapped-out page's PTE stays
+// behind, invalid, with PTE_SWAP set, the page's permission bits,
+// and the number of the swap slot holding it in place of the PPN.
+// The next touch of the page faults and swapin() reads it back.
+//
+// Victims are chosen by a clock that sweeps over all processes'
+// page tables. A PTE with PTE_A set was used since the hand last
+// passed: the hand clears PTE_A and moves on, and it takes the
+// pages it finds still clear. (The working-set sampler clears
+// PTE_A too; wssreferenced() accounts for that.) Only pages that
+// one process maps and that no file backs are taken: heap, data
+// and stack, anonymous mmap() memory, and private copies of file
+// pages. Leaf tables shared since fork are skipped until their
+// owners unshare them.
+//
+// Ahead of the disk sits a pool of compressed pages in memory.
+// A victim that LZ4 compresses to half a page or less goes there
+// instead, two to a pool page, and faults back in without any I/O.
+// Slots below NSWAP are on the disk, the NZSLOT above them in the
+// pool.
+//
+// Only a process itself changes its page table, so the clock only
+// looks at the current process, from pagefault() before it has a
+// PTE in hand, and at processes preempted in user space, with their
+// lock held (pagetableidle()). A process asleep or preempted in the
+// kernel may be using a PTE or a page of its own, which the clock
+// must not swap out from under it. Threads and the processes they
+// belong to are passed over too (see clone()). Slots are reference
+// counted, since fork() copies a swapped-out page by copying its
+// PTE.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "buf.h"
+#include "file.h"
+#include "fcntl.h"
+#include "memstat.h"
+#include "defs.h"
+
+#define SWAPLOW   64   // free pages pagefault() keeps in reserve
+#define SWAPBATCH 32   // pages reclaimed at a time
+#define BPP (PGSIZE / BSIZE)  // disk blocks per page
+#define NZSLOT (2*NZPOOL)     // compressed pages the pool holds
+#define ZMAX (PGSIZE / 2)     // largest compressed page kept
+
+extern struct superblock sb;
+extern struct proc proc[NPROC];
+
+struct victim {
+  char *pa;
+  uint slot;
+};
+
+// a pool page, holding one compressed page at its start and
+// another at its end.
+struct zpage {
+  uchar *data;
+  ushort len[2];          // bytes in each half, 0 if free
+};
+
+struct {
+  struct spinlock lock;   // protects the slots and the pool
+  uchar ref[NSWAP+NZSLOT];  // PTEs that refer to each slot
+  int nused;              // disk slots in use
+  int next;               // where to look for a free disk slot
+  struct zpage zpool[NZPOOL];
+  int nzused;             // pool slots in use
+  int nzpage;             // pool pages allocated
+  uint64 zbytes;          // compressed bytes in the pool
+  uint64 nzin;            // pages decompressed
+  uint64 tzin;            // time spent faulting them in
+
+  struct sleeplock io;    // held for swap I/O and by the clock
+  struct buf buf;         // for disk I/O, under io
+  uchar zbuf[ZMAX];       // for compression, under io
+  int hand;               // clock hand: index in proc[]
+  uint64 handva;          // and address within it
+  uint64 nout;            // pages written to disk
+  uint64 nin;             // pages read back from disk
+  uint64 tin;             // time spent faulting them in
+  uint64 nzout;           // pages compressed
+  uint64 nzreject;        // pages that did not compress enough
+} swap;
+
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.io, "swapio");
+}
+
+// Slots on the disk; none before fsinit() reads the superblock,
+// or if mkfs made no swap area.
+static int
+nslot(void)
+{
+  return sb.nswap < NSWAP ? sb.nswap : NSWAP;
+}
+
+// Bytes of swap space not in use.
+uint64
+swapspace(void)
+{
+  return (uint64)(nslot() - swap.nused) * PGSIZE;
+}
+
+static int
+validslot(uint slot)
+{
+  return slot < nslot() || (slot >= NSWAP && slot < NSWAP+NZSLOT);
+}
+
+// Pool page and half that hold a pool slot's data.
+static struct zpage*
+zslot(uint slot, int *half)
+{
+  *half = (slot - NSWAP) % 2;
+  return &swap.zpool[(slot - NSWAP) / 2];
+}
+
+static uchar*
+zdata(struct zpage *z, int half)
+{
+  return half == 0 ? z->data : z->data + PGSIZE - z->len[1];
+}
+
+// Compress the page at pa into the pool. Returns its slot, or
+// -1 if it compresses too little or the pool is full.
+// Caller holds swap.io.
+static int
+zstore(char *pa)
+{
+  struct zpage *z;
+  int i, len, half, slot = -1;
+
+  if((len = lz4compress((uchar*)pa, PGSIZE, swap.zbuf, ZMAX)) == 0){
+    swap.nzreject++;
+    return -1;
+  }
+
+  acquire(&swap.lock);
+  // fill the free half of a pool page before starting another.
+  for(i = 0; i < NZPOOL && slot < 0; i++){
+    z = &swap.zpool[i];
+    if(z->data && (z->len[0] == 0 || z->len[1] == 0))
+      slot = NSWAP + 2*i + (z->len[0] != 0);
+  }
+  for(i = 0; i < NZPOOL && slot < 0; i++){
+    z = &swap.zpool[i];
+    if(z->data == 0){
+      if((z->data = kalloc()) == 0)
+        break;
+      swap.nzpage++;
+      slot = NSWAP + 2*i;
+    }
+  }
+  if(slot >= 0){
+    z = zslot(slot, &half);
+    z->len[half] = len;
+    memmove(zdata(z, half), swap.zbuf, len);
+    swap.ref[slot] = 1;
+    swap.nzused++;
+    swap.zbytes += len;
+    swap.nzout++;
+  }
+  release(&swap.lock);
+  return slot;
+}
+
+// The last reference to pool slot is gone. Caller holds swap.lock.
+static void
+zrelease(uint slot)
+{
+  struct zpage *z;
+  int half;
+
+  z = zslot(slot, &half);
+  swap.zbytes -= z->len[half];
+  z->len[half] = 0;
+  swap.nzused--;
+  if(z->len[0] == 0 && z->len[1] == 0){
+    kfree(z->data);
+    z->data = 0;
+    swap.nzpage--;
+  }
+}
+
+static int
+slotalloc(void)
+{
+  int i, n = nslot(), slot = -1;
+
+  acquire(&swap.lock);
+  for(i = 0; i < n; i++){
+    if(swap.ref[swap.next] == 0){
+      slot = swap.next;
+      swap.ref[slot] = 1;
+      swap.nused++;
+      break;
+    }
+    swap.next = (swap.next + 1) % n;
+  }
+  release(&swap.lock);
+  return slot;
+}
+
+// Another PTE refers to slot, at fork.
+void
+swapdup(uint slot)
+{
+  acquire(&swap.lock);
+  if(!validslot(slot) || swap.ref[slot] == 0 || swap.ref[slot] == 255)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// A PTE that referred to slot is gone.
+void
+swapfree(uint slot)
+{
+  acquire(&swap.lock);
+  if(!validslot(slot) || swap.ref[slot] == 0)
+    panic("swapfree");
+  if(--swap.ref[slot] == 0){
+    if(slot >= NSWAP)
+      zrelease(slot);
+    else
+      swap.nused--;
+  }
+  release(&swap.lock);
+}
+
+// Copy the page at pa to or from slot. Caller holds swap.io.
+static void
+swaprw(uint slot, char *pa, int write)
+{
+  struct buf *b = &swap.buf;
+  int i;
+
+  for(i = 0; i < BPP; i++){
+    b->dev = ROOTDEV;
+    b->blockno = sb.swapstart + slot * BPP + i;
+    if(write)
+      memmove(b->data, pa + i * BSIZE, BSIZE);
+    virtio_disk_rw(b, write);
+    if(!write)
+      memmove(pa + i * BSIZE, b->data, BSIZE);
+  }
+}
+
+// Could the page that pte maps at va be swapped out?
+static int
+swappable(struct proc *p, uint64 va, pte_t pte)
+{
+  struct vma *v;
+
+  if((pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+    return 0;
+  if(getmapcount((void*)PTE2PA(pte)) != 1)
+    return 0;
+  if(va < p->sz)
+    return !intext(p, va);
+  if(va >= MMAPBASE && (v = vmalookup(p, va)) != 0)
+    return v->f == 0 || (v->flags & MAP_PRIVATE);
+  return 0;
+}
+
+// Move the clock hand over p from swap.handva, taking up to n
+// pages into v[] and leaving swap PTEs in their place. Pages that
+// compress well go into the pool at once; the others get a disk
+// slot, to be written once p->lock is released. Sets *done if the
+// hand reached the end of p. Returns the number of pages taken.
+// Caller holds p->lock and swap.io.
+static int
+swapscan(struct proc *p, struct victim *v, int n, int *done)
+{
+  pte_t *pte;
+  uint64 va = swap.handva;
+  int got = 0, touched = 0, slot;
+  char *pa;
+
+  while(got < n && (pte = walknext(p->pagetable, &va, MMAPTOP)) != 0){
+    if(swappable(p, va, *pte)){
+      if(wssreferenced(pte)){
+        touched = 1;
+      } else {
+        pa = (char*)PTE2PA(*pte);
+        if((slot = zstore(pa)) < 0 && (slot = slotalloc()) < 0)
+          break;
+        v[got].pa = pa;
+        v[got].slot = slot;
+        *pte = SWAP2PTE(slot) | PTE_SWAP |
+               (PTE_FLAGS(*pte) & ~(PTE_V|PTE_A|PTE_D));
+        p->mem.rss--;
+        if(va >= MMAPBASE)
+          p->mem.rssmmap--;
+        p->mem.swapped++;
+        got++;
+      }
+    }
+    va += PGSIZE;
+  }
+  swap.handva = va;
+  *done = va >= MMAPTOP;
+
+  if(got || touched){
+    if(p == myproc())
+      uvmsfenceall(p->pagetable);
+    else
+      p->tlbstale = (1L << NCPU) - 1;
+  }
+  return got;
+}
+
+// Swap out up to n pages. Returns how many went.
+// Caller must hold no spinlocks.
+int
+swapreclaim(int n)
+{
+  struct victim v[SWAPBATCH];
+  struct proc *p;
+  int i, got, done, total = 0, visits;
+
+  if(n > SWAPBATCH)
+    n = SWAPBATCH;
+
+  acquiresleep(&swap.io);
+  // twice round: pages whose PTE_A the first pass cleared
+  // are fair game on the second.
+  for(visits = 0; visits < 2*NPROC && total < n; ){
+    p = &proc[swap.hand];
+    got = 0;
+    done = 1;
+    acquire(&p->lock);
+    if(p == myproc() ? !threaded(p) : pagetableidle(p))
+      got = swapscan(p, v, n - total, &done);
+    release(&p->lock);
+
+    for(i = 0; i < got; i++){
+      if(v[i].slot < NSWAP){
+        swaprw(v[i].slot, v[i].pa, 1);
+        swap.nout++;
+      }
+      kfree(v[i].pa);
+    }
+    total += got;
+
+    if(done){
+      swap.hand = (swap.hand + 1) % NPROC;
+      swap.handva = 0;
+      visits++;
+    }
+    if(got == 0 && !done)
+      break;  // out of slots
+  }
+  releasesleep(&swap.io);
+  return total;
+}
+
+// Top up free memory from swap if it is running low. Does
+// nothing if the caller holds a spinlock, since swapping sleeps.
+void
+swapreserve(void)
+{
+  int locked;
+
+  if(kfreemem() >= SWAPLOW * PGSIZE)
+    return;
+  if(swapspace() == 0 && swap.nzused == NZSLOT)
+    return;
+  push_off();
+  locked = mycpu()->noff > 1;
+  pop_off();
+  if(!locked)
+    swapreclaim(SWAPBATCH);
+}
+
+// The page at va is swapped out, as pte says; read it back in.
+// This sleeps on the disk, so the caller must hold no spinlock:
+// kernel copies fault swapped pages in before taking one.
+// Returns 0, or -1 if there is no memory.
+int
+swapin(pagetable_t pagetable, uint64 va, pte_t *pte)
+{
+  uint slot = PTE2SWAP(*pte);
+  uint64 t0 = r_time();
+  struct proc *p = myproc();
+  struct zpage *z;
+  char *mem;
+  int half;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  if(slot >= NSWAP){
+    acquire(&swap.lock);
+    z = zslot(slot, &half);
+    if(lz4decompress(zdata(z, half), z->len[half], (uchar*)mem, PGSIZE) != PGSIZE)
+      panic("swapin: bad compressed page");
+    swap.nzin++;
+    swap.tzin += r_time() - t0;
+    release(&swap.lock);
+  } else {
+    acquiresleep(&swap.io);
+    swaprw(slot, mem, 0);
+    swap.nin++;
+    swap.tin += r_time() - t0;
+    releasesleep(&swap.io);
+  }
+  *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_V;
+  swapfree(slot);
+  if(p && p->pagetable == pagetable){
+    p = leaderof(p);
+    p->mem.rss++;
+    if(va >= MMAPBASE)
+      p->mem.rssmmap++;
+    p->mem.swapped--;
+  }
+  return 0;
+}
+
+// Fill in the swap fields of a memstat.
+void
+swapusage(struct memstat *m)
+{
+  m->swap = swap.nused;
+  m->swaptotal = nslot();
+  m->zswap = swap.nzused;
+  m->zpool = swap.nzpage;
+}
+
+// Print swap statistics into buf, for the statistics device.
+// Times are in ticks of the time register.
+int
+statsswap(char *buf, int sz)
+{
+  int n, ratio;
+
+  ratio = swap.zbytes ? swap.nzused * PGSIZE * 100 / swap.zbytes : 0;
+  n = snprintf(buf, sz, "--- swap\n");
+  n += snprintf(buf+n, sz-n, "disk: %d/%d slots, out %d, in %d, %d ticks/fault\n",
+                swap.nused, nslot(), (int)swap.nout, (int)swap.nin,
+                swap.nin ? (int)(swap.tin / swap.nin) : 0);
+  n += snprintf(buf+n, sz-n, "zswap: %d pages in %d/%d pool pages, ratio %d.%d%d\n",
+                swap.nzused, swap.nzpage, NZPOOL, ratio / 100, ratio / 10 % 10, ratio % 10);
+  n += snprintf(buf+n, sz-n, "zswap: out %d, rejected %d, in %d, %d ticks/fault\n",
+                (int)swap.nzout, (int)swap.nzreject, (int)swap.nzin,
+                swap.nzin ? (int)(swap.tzin / swap.nzin) : 0);
+  return n;
+}
@@ -12,7 +12,8 @@ int
 fetchaddr(uint64 addr, uint64 *ip)
 {
   struct proc *p = myproc();
-  if(addr >= p->sz || addr+sizeof(uint64) > p->sz) // both tests needed, in case of overflow
+  uint64 sz = leaderof(p)->sz;
+  if(addr >= sz || addr+sizeof(uint64) > sz) // both tests needed, in case of overflow
     return -1;
   if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
@@ -112,6 +113,16 @@ extern uint64 sys_connect(void);
 extern uint64 sys_symlink(void);
 extern uint64 sys_mmap(void);
 extern uint64 sys_munmap(void);
+extern uint64 sys_madvise(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_memstat(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_nanosleep(void);
+extern uint64 sys_setpriority(void);
+extern uint64 sys_cpustat(void);
+extern uint64 sys_setaffinity(void);
+extern uint64 sys_futex_wait(void);
+extern uint64 sys_futex_wake(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -148,60 +159,41 @@ static uint64 (*syscalls[])(void) = {
 [SYS_symlink] sys_symlink,
 [SYS_mmap] sys_mmap,
 [SYS_munmap] sys_munmap,
-};
-
-static char *syscallnames[] = {
-[SYS_fork]    "fork",
-[SYS_exit]    "exit",
-[SYS_wait]    "wait",
-[SYS_pipe]    "pipe",
-[SYS_read]    "read",
-[SYS_kill]    "kill",
-[SYS_exec]    "exec",
-[SYS_fstat]   "fstat",
-[SYS_chdir]   "chdir",
-[SYS_dup]     "dup",
-[SYS_getpid]  "getpid",
-[SYS_sbrk]    "sbrk",
-[SYS_sleep]   "slepp",
-[SYS_uptime]  "uptime",
-[SYS_open]    "open",
-[SYS_write]   "write",
-[SYS_mknod]   "mknod",
-[SYS_unlink]  "unlink",
-[SYS_link]    "link",
-[SYS_mkdir]   "mkdir",
-[SYS_close]   "close",
-[SYS_trace]   "trace",
-[SYS_sysinfo] "sysinfo",
-[SYS_pgaccess] "pgaccess",
-[SYS_sigalarm] "sigalarm",
-[SYS_sigreturn] "sigreturn",
-#ifdef LAB_NET
-[SYS_connect] "connect",
-#endif
-[SYS_symlink] "symlink",
-[SYS_mmap] "mmap",
-[SYS_munmap] "munmap",
+[SYS_madvise] sys_madvise,
+[SYS_spawn] sys_spawn,
+[SYS_memstat] sys_memstat,
+[SYS_clone] sys_clone,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_setpriority] sys_setpriority,
+[SYS_cpustat] sys_cpustat,
+[SYS_setaffinity] sys_setaffinity,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
 };
 
 void
 syscall(void)
 {
-  int num;
+  int num, traced;
   struct proc *p = myproc();
+  uint64 arg[6], start = 0;
 
   num = p->trapframe->a7;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
+    traced = num < 64 && (p->tracemask & (1UL << num));
+    if(traced){
+      memmove(arg, &p->trapframe->a0, sizeof(arg));
+      start = r_time();
+    }
     // Use num to lookup the system call function for num, call it,
     // and store its return value in p->trapframe->a0
     uint64 a0 = syscalls[num]();
+    fdunhold(p);
     if (num != SYS_sigreturn) {
       p->trapframe->a0 = a0;
     }
-    if (p->tracemask & (1 << num)) {
-      printf("%d: syscall %s -> %d\n", p->pid, syscallnames[num], p->trapframe->a0);
-    }
+    if(traced)
+      systrace(num, arg, start, p->trapframe->a0);
   } else {
     printf("%d %s: unknown sys call %d\n",
             p->pid, p->name, num);
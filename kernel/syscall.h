@@ -29,3 +29,13 @@
 #define SYS_symlink 28
 #define SYS_mmap 29
 #define SYS_munmap 30
+#define SYS_madvise 31
+#define SYS_spawn 32
+#define SYS_memstat 33
+#define SYS_clone 34
+#define SYS_nanosleep 35
+#define SYS_setpriority 36
+#define SYS_cpustat 37
+#define SYS_setaffinity 38
+#define SYS_futex_wait 39
+#define SYS_futex_wake 40
@@ -16,6 +16,7 @@
 #include "file.h"
 #include "fcntl.h"
 #include "sysinfo.h"
+#include "memstat.h"
 #include "memlayout.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
@@ -27,7 +28,7 @@ argfd(int n, int *pfd, struct file **pf)
   struct file *f;
 
   argint(n, &fd);
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if((f=fdhold(fd)) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -36,23 +37,6 @@ argfd(int n, int *pfd, struct file **pf)
   return 0;
 }
 
-// Allocate a file descriptor for the given file.
-// Takes over file reference from caller on success.
-static int
-fdalloc(struct file *f)
-{
-  int fd;
-  struct proc *p = myproc();
-
-  for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
-      return fd;
-    }
-  }
-  return -1;
-}
-
 uint64
 sys_dup(void)
 {
@@ -104,8 +88,9 @@ sys_close(void)
 
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
-  fileclose(f);
+  // another thread may have closed fd since.
+  if((f = fdclear(myproc(), fd)) != 0)
+    fileclose(f);
   return 0;
 }
 
@@ -457,24 +442,20 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+// Fetch the user's argv array at uargv into kalloc()ed pages.
+static int
+fetchargv(uint64 uargv, char **argv, int max)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  argaddr(1, &uargv);
-  if(argstr(0, path, MAXPATH) < 0) {
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, max*sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
-      goto bad;
+    if(i >= max){
+      return -1;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
-      goto bad;
+      return -1;
     }
     if(uarg == 0){
       argv[i] = 0;
@@ -482,22 +463,61 @@ sys_exec(void)
     }
     argv[i] = kalloc();
     if(argv[i] == 0)
-      goto bad;
+      return -1;
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
-      goto bad;
+      return -1;
   }
+  return 0;
+}
 
-  int ret = exec(path, argv);
+static void
+freeargv(char **argv, int max)
+{
+  int i;
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
+  for(i = 0; i < max && argv[i] != 0; i++)
     kfree(argv[i]);
+}
 
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+  int ret = -1;
+
+  argaddr(1, &uargv);
+  if(argstr(0, path, MAXPATH) < 0) {
+    return -1;
+  }
+  if(fetchargv(uargv, argv, NELEM(argv)) == 0)
+    ret = exec(path, argv);
+  freeargv(argv, NELEM(argv));
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv, ufds;
+  int fds[NOFILE], nfd;
+  int ret = -1;
+
+  argaddr(1, &uargv);
+  argaddr(2, &ufds);
+  argint(3, &nfd);
+  if(argstr(0, path, MAXPATH) < 0) {
+    return -1;
+  }
+  if(nfd > NOFILE)
+    return -1;
+  if(nfd > 0 && copyin(myproc()->pagetable, (char*)fds, ufds, nfd*sizeof(int)) < 0)
+    return -1;
+  if(fetchargv(uargv, argv, NELEM(argv)) == 0)
+    ret = spawn(path, argv, fds, nfd);
+  freeargv(argv, NELEM(argv));
+  return ret;
 }
 
 uint64
@@ -514,15 +534,15 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
+      fdclear(p, fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+    fdclear(p, fd0);
+    fdclear(p, fd1);
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -533,8 +553,8 @@ sys_pipe(void)
 uint64
 sys_trace(void) {
   struct proc *p = myproc();
-  int tracemask;
-  argint(0, &tracemask);
+  uint64 tracemask;
+  argaddr(0, &tracemask);
   p->tracemask |= tracemask;
   return 0;
 }
@@ -553,6 +573,44 @@ sys_sysinfo(void) {
   return 0;
 }
 
+// memstat(pid, struct memstat *st): system-wide memory use, and
+// that of process pid, or of the caller if pid is 0. Every number
+// is a counter the kernel keeps as it goes, so this costs the same
+// however much memory there is.
+uint64
+sys_memstat(void)
+{
+  struct proc *p = myproc();
+  struct memstat st;
+  struct memuse mu;
+  struct wsinfo ws;
+  uint64 addr;
+  int pid, i;
+
+  argint(0, &pid);
+  argaddr(1, &addr);
+  if(procmemuse(pid ? pid : p->pid, &mu, &ws) < 0)
+    return -1;
+
+  st.total = ktotalpages();
+  st.free = kfreemem() / PGSIZE;
+  st.shared = ksharedpages();
+  st.pagetable = ptpages();
+  st.pcache = pcachepages();
+  st.ksm = ksmpages();
+  swapusage(&st);
+  st.rss = mu.rss;
+  st.rssmmap = mu.rssmmap;
+  st.swapped = mu.swapped;
+  st.ptpages = mu.npt;
+  st.wss = ws.size;
+  for(i = 0; i < NWSSHIST; i++)
+    st.hist[i] = ws.hist[i];
+  if(copyout(p->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
 uint64
 sys_sigalarm(void) {
   struct proc *p = myproc();
@@ -629,6 +687,19 @@ sys_symlink(void) {
   return 0;
 }
 
+// vmamap() with the threads that share proc's memory locked out.
+static uint64
+mmaplocked(struct proc *proc, uint64 va, int length, int prot, int flags,
+           struct file *f, int offset)
+{
+  uint64 r;
+
+  vmlock(proc, 1);
+  r = vmamap(proc, va, length, prot, flags, f, offset);
+  vmunlock(proc);
+  return r;
+}
+
 uint64
 sys_mmap(void)
 {
@@ -638,17 +709,37 @@ sys_mmap(void)
   int flags;
   int fd;
   int offset;
-  struct file *file;
-  struct proc *proc = myproc();
-  int i;
+  struct file *file = 0;
+  struct proc *proc = leaderof(myproc());
 
   argaddr(0, &p);
   argint(1, &length);
   argint(2, &prot);
   argint(3, &flags);
-  argfd(4, &fd, &file);
   argint(5, &offset);
 
+  if (((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0)) {
+    return -1;
+  }
+  if (length <= 0) {
+    return -1;
+  }
+
+  if (flags & MAP_ANONYMOUS) {
+    return mmaplocked(proc, p, length, prot, flags, 0, 0);
+  }
+
+  if (argfd(4, &fd, &file) < 0) {
+    return -1;
+  }
+  // mapped pages come straight from the page cache.
+  if (offset < 0 || offset % PGSIZE != 0) {
+    return -1;
+  }
+  if (file->type != FD_INODE) {
+    return -1;
+  }
+
   if (prot & PROT_READ) {
     if (file->readable !=1) {
       return -1;
@@ -660,74 +751,83 @@ sys_mmap(void)
     }
   }
 
-  struct vma *vma;
-  uint64 va = MMAPBASE;
+  return mmaplocked(proc, p, length, prot, flags, file, offset);
+}
 
-  for (i = 0; i < 16; i++) {
-    if (proc->vma[i].used == 0) {
-      break;
-    }
-    va += MMAPMAX;
-  }
+uint64
+sys_munmap(void)
+{
+  uint64 va;
+  int length, r;
+  struct proc *proc = leaderof(myproc());
 
-  if (i >= 16) {
+  argaddr(0, &va);
+  argint(1, &length);
+
+  if (length < 0) {
     return -1;
   }
+  vmlock(proc, 1);
+  r = vmaunmap(proc, va, length);
+  vmunlock(proc);
+  return r;
+}
+
+// Advise how a mapping will be used. NORMAL, RANDOM and
+// SEQUENTIAL set how many pages around a fault get mapped, for
+// the whole mapping that addr is in; WILLNEED maps the range now;
+// DONTNEED unmaps it, writing back dirty shared pages, so that it
+// is faulted in again from the file, or as zeros.
+// Caller holds vmlock().
+static int
+madvise(struct proc *proc, uint64 va, int length, int advice)
+{
+  struct vma *vma;
+  uint64 a, end;
 
-  vma = &proc->vma[i];
-  vma->f = file;
-  vma->vastart = va;
-  vma->vaend = va + length;
-  vma->used = 1;
-  vma->offset = offset;
-  vma->ip = file->ip;
-  vma->mode = prot;
-  vma->flags = flags;
-  vma->length = length;
+  if (length < 0 || va % PGSIZE != 0) {
+    return -1;
+  }
+  if ((vma = vmalookup(proc, va)) == 0) {
+    return -1;
+  }
+  end = PGROUNDUP(va + length);
 
-  filedup(file);
-  return va;
+  switch (advice) {
+  case MADV_NORMAL:
+  case MADV_RANDOM:
+  case MADV_SEQUENTIAL:
+    vma->advice = advice;
+    return 0;
+  case MADV_WILLNEED:
+    for (a = va; a < end; a += PGSIZE) {
+      if (vmalookup(proc, a) == 0) {
+        return -1;
+      }
+      if (walkaddr(proc->pagetable, a) == 0 && pagefault(proc->pagetable, a, 0) < 0) {
+        return -1;
+      }
+    }
+    return 0;
+  case MADV_DONTNEED:
+    return vmadiscard(proc, va, length);
+  }
+  return -1;
 }
 
 uint64
-sys_munmap(void)
+sys_madvise(void)
 {
-  struct proc *proc = myproc();
+  struct proc *proc = leaderof(myproc());
   uint64 va;
-  uint64 pa;
-  int length;
+  int length, advice, r;
 
   argaddr(0, &va);
   argint(1, &length);
+  argint(2, &advice);
 
-  int npages = length/PGSIZE;
-  uint64 a;
-  pte_t *pte = 0;
-  struct vma *vma = &proc->vma[(va-MMAPBASE)/MMAPMAX];
-  int offset = va - vma->vastart + vma->offset;
-  // write back
-  for (a = va; a < va + npages*PGSIZE; a += PGSIZE) {
-    // write back
-    pte = walk(proc->pagetable, a, 0);
-    if (vma->flags & MAP_SHARED && pte && *pte & PTE_V) {
-        pa = (uint64)PTE2PA(*pte);
-        begin_op();
-        ilock(vma->ip);
-        writei(vma->ip, 0, pa, offset, PGSIZE);
-        iunlock(vma->ip);
-        end_op();
-    }
-    offset += PGSIZE;
-    vma->length -= PGSIZE;
-    if (pte && *pte & PTE_V) {
-      uvmunmap(proc->pagetable, a, 1, 1);
-      pte = 0;
-    }
-  }
-  
-  if (vma->length == 0) {
-    vma->used = 0;
-    fileclose(vma->f);
-  }
-  return 0;
-}
\ No newline at end of file
+  vmlock(proc, 1);
+  r = madvise(proc, va, length, advice);
+  vmunlock(proc);
+  return r;
+}
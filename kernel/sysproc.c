@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "cpustat.h"
 
 uint64
 sys_exit(void)
@@ -27,6 +28,17 @@ sys_fork(void)
   return fork();
 }
 
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  argaddr(0, &fn);
+  argaddr(1, &arg);
+  argaddr(2, &stack);
+  return clone(fn, arg, stack);
+}
+
 uint64
 sys_wait(void)
 {
@@ -39,33 +51,42 @@ uint64
 sys_sbrk(void)
 {
   uint64 addr;
-  int n;
+  int n, r;
+  struct proc *p = myproc();
 
   argint(0, &n);
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
+  vmlock(p, 1);
+  addr = leaderof(p)->sz;
+  r = growproc(n);
+  vmunlock(p);
+  if(r < 0)
     return -1;
   return addr;
 }
 
+// sleep for n clock ticks, on a timer of its own rather than
+// waking for each tick.
 uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
   // backtrace(); comment for leater labs.
   argint(0, &n);
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  if(n <= 0)
+    return 0;
+  return hrsleep(r_time() + (uint64)n * TICKINTERVAL);
+}
+
+// sleep for ns nanoseconds, or a little more.
+uint64
+sys_nanosleep(void)
+{
+  uint64 ns;
+
+  argaddr(0, &ns);
+  if(ns == 0)
+    return 0;
+  return hrsleep(r_time() + (ns + NSPERTIME - 1) / NSPERTIME);
 }
 
 uint64
@@ -84,6 +105,7 @@ sys_uptime(void)
 {
   uint xticks;
 
+  clockupdate();
   acquire(&tickslock);
   xticks = ticks;
   release(&tickslock);
@@ -106,9 +128,11 @@ sys_pgaccess(void)
   a = PGROUNDDOWN(p);
   for (int i = 0; i < n; i++) {
     pte_t *pte = walk(proc->pagetable, a, 0);
-    if (*pte & PTE_A) {
+    if (pte && (*pte & PTE_A)) {
       mask |= (1 << i);
       *pte = *pte & ~PTE_A;
+      // so that the next access sets PTE_A again.
+      uvmsfence(proc->pagetable, a);
     }
     a += PGSIZE;
   }
@@ -118,3 +142,81 @@ sys_pgaccess(void)
   }
   return 0;
 }
+
+// setpriority(pid, nice): set the nice value of process pid, or of
+// the caller if pid is 0.
+uint64
+sys_setpriority(void)
+{
+  int pid, nice;
+
+  argint(0, &pid);
+  argint(1, &nice);
+  return setnice(pid ? pid : myproc()->pid, nice);
+}
+
+// setaffinity(pid, mask): let process pid, or the caller if pid
+// is 0, run only on the harts in mask. The caller moves off this
+// hart at once if mask leaves it out.
+uint64
+sys_setaffinity(void)
+{
+  struct proc *p = myproc();
+  uint64 mask;
+  int pid, move;
+
+  argint(0, &pid);
+  argaddr(1, &mask);
+  if(setaffinity(pid ? pid : p->pid, mask) < 0)
+    return -1;
+  push_off();
+  move = (mask & (1L << cpuid())) == 0;
+  pop_off();
+  if((pid == 0 || pid == p->pid) && move)
+    yield();
+  return 0;
+}
+
+// cpustat(pid, struct cpustat *st): the CPU use of process pid,
+// or of the caller if pid is 0.
+uint64
+sys_cpustat(void)
+{
+  struct cpustat st;
+  uint64 addr;
+  int pid;
+
+  argint(0, &pid);
+  argaddr(1, &addr);
+  if(proccpustat(pid ? pid : myproc()->pid, &st) < 0)
+    return -1;
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// futex_wait(addr, val, timeout): sleep while the word at addr
+// holds val, for at most timeout ns if not 0. See futex.c.
+uint64
+sys_futex_wait(void)
+{
+  uint64 addr, ns;
+  int val;
+
+  argaddr(0, &addr);
+  argint(1, &val);
+  argaddr(2, &ns);
+  return futexwait(addr, val, ns);
+}
+
+// futex_wake(addr, n): wake up to n processes waiting on addr.
+uint64
+sys_futex_wake(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return futexwake(addr, n);
+}
@@ -0,0 +1,165 @@
+// System call tracing.
+//
+// trace(mask) marks the calls a process (and its children) should
+// have traced. Writing 1 to the systrace device turns tracing on,
+// and 0 turns it off; while it is on, syscall() hands each marked
+// call to systrace() as it returns, with its arguments, its return
+// value and the time register at entry and exit.
+//
+// Each hart keeps the records in a ring of its own, which only
+// system calls returning on that hart add to, with interrupts off,
+// and only readers of the device take from. A record that finds
+// the ring full is dropped. A read waits for records while tracing
+// is on, and returns 0 once it is off and the rings are empty.
+// user/trace.c reads them.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "systrace.h"
+#include "defs.h"
+
+#define NSYSRING 512    // records per hart; a power of 2
+
+extern uint ticks;
+
+struct ring {
+  uint head;            // next record to add; only the hart writes it
+  uint tail;            // next record to read
+  uint nlost;           // records dropped with the ring full
+  struct sysrec r[NSYSRING];
+};
+
+static struct {
+  struct spinlock lock; // serializes readers
+  int on;
+  struct ring ring[NCPU];
+} tr;
+
+// Record system call num of the current process, called at start
+// with arguments arg, returning ret.
+void
+systrace(int num, uint64 *arg, uint64 start, uint64 ret)
+{
+  struct ring *r;
+  struct sysrec *s;
+
+  if(!tr.on)
+    return;
+  // keep other calls off this hart's ring until the record is in.
+  push_off();
+  r = &tr.ring[cpuid()];
+  if(r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == NSYSRING){
+    r->nlost++;
+    pop_off();
+    return;
+  }
+  s = &r->r[r->head % NSYSRING];
+  s->entry = start;
+  s->exit = r_time();
+  memmove(s->arg, arg, sizeof(s->arg));
+  s->ret = ret;
+  s->pid = myproc()->pid;
+  s->num = num;
+  __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+  pop_off();
+}
+
+// Take the oldest record of some hart's ring into s.
+// Returns 0 if there are none.
+static int
+take(struct sysrec *s)
+{
+  struct ring *r;
+  int found = 0;
+
+  acquire(&tr.lock);
+  for(r = tr.ring; r < &tr.ring[NCPU]; r++){
+    if(r->tail != __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)){
+      *s = r->r[r->tail % NSYSRING];
+      __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+      found = 1;
+      break;
+    }
+  }
+  release(&tr.lock);
+  return found;
+}
+
+int
+systraceread(int user_dst, uint64 dst, int n)
+{
+  struct sysrec s;
+  int tot = 0;
+  uint ticks0;
+
+  while(n - tot >= sizeof(s)){
+    if(!take(&s)){
+      if(tot > 0 || !tr.on)
+        break;
+      // wait a tick for more.
+      acquire(&tickslock);
+      ticks0 = ticks;
+      while(ticks == ticks0){
+        if(killed(myproc())){
+          release(&tickslock);
+          return -1;
+        }
+        sleep(&ticks, &tickslock);
+      }
+      release(&tickslock);
+      continue;
+    }
+    if(either_copyout(user_dst, dst + tot, &s, sizeof(s)) < 0)
+      return -1;
+    tot += sizeof(s);
+  }
+  return tot;
+}
+
+// Turn tracing on or off. Turning it on drops the records of
+// earlier runs that nobody read.
+int
+systracewrite(int user_src, uint64 src, int n)
+{
+  struct ring *r;
+  int on;
+
+  if(n != sizeof(on) || either_copyin(&on, user_src, src, sizeof(on)) < 0)
+    return -1;
+  acquire(&tr.lock);
+  if(on && !tr.on){
+    for(r = tr.ring; r < &tr.ring[NCPU]; r++)
+      __atomic_store_n(&r->tail, __atomic_load_n(&r->head, __ATOMIC_ACQUIRE),
+                       __ATOMIC_RELEASE);
+  }
+  tr.on = on != 0;
+  release(&tr.lock);
+  return n;
+}
+
+// Print the records the rings dropped into buf, for the
+// statistics device.
+int
+statssystrace(char *buf, int sz)
+{
+  int i, nlost = 0;
+
+  for(i = 0; i < NCPU; i++)
+    nlost += tr.ring[i].nlost;
+  return snprintf(buf, sz, "systrace: %s, %d lost\n", tr.on ? "on" : "off", nlost);
+}
+
+void
+systraceinit(void)
+{
+  initlock(&tr.lock, "systrace");
+  devsw[SYSTRACE].read = systraceread;
+  devsw[SYSTRACE].write = systracewrite;
+}
@@ -0,0 +1,9 @@
+// A traced system call, as read from the systrace device.
+struct sysrec {
+  uint64 entry;               // time register at the call
+  uint64 exit;                // and at its return
+  uint64 arg[6];              // a0-a5 at the call
+  uint64 ret;                 // a0 at the return
+  int pid;
+  int num;                    // SYS_ number
+};
@@ -6,12 +6,19 @@
 #include "proc.h"
 #include "defs.h"
 #include "fcntl.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "page.h"
 
 struct spinlock tickslock;
 uint ticks;
+static uint64 boottime;   // time register when ticks was 0
 
 extern char trampoline[], uservec[], userret[];
 
+extern uint64 timer_scratch[NCPU][6]; // start.c
+
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
 
@@ -21,6 +28,7 @@ void
 trapinit(void)
 {
   initlock(&tickslock, "time");
+  boottime = r_time();
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -47,6 +55,14 @@ usertrap(void)
   w_stvec((uint64)kernelvec);
 
   struct proc *p = myproc();
+  uint64 now = r_time();
+
+  // p may now use its memory; see pagetableidle().
+  p->atuser = 0;
+
+  // the time since usertrapret() was spent in user space.
+  p->utime += now - p->tstamp;
+  p->tstamp = now;
   
   // save user program counter.
   p->trapframe->epc = r_sepc();
@@ -67,24 +83,25 @@ usertrap(void)
 
     syscall();
   } 
-  else if (r_scause() == 15) {
-    uint64 va = r_stval();
-    if (va >= p->sz || pagefault(p->pagetable, va) != 0) {
-      setkilled(p);
-    }
-  }
-  else if (r_scause() == 13) {
+  else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // page fault: demand-paged text, mmap, or copy-on-write.
     uint64 va = r_stval();
-    if (va < MMAPBASE) {
-      printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
-      printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
+    int access = r_scause() == 15 ? FAULT_WRITE :
+                 r_scause() == 12 ? FAULT_EXEC : FAULT_READ, r;
+    intr_on();
+    // other threads may be faulting in the same page table.
+    vmlock(p, 1);
+    r = pagefault(p->pagetable, va, access);
+    vmunlock(p);
+    if(r != 0){
+      printf("usertrap(): page fault %p pid=%d\n", r_scause(), p->pid);
+      printf("            sepc=%p stval=%p\n", r_sepc(), va);
       setkilled(p);
-    } else {
-      pagefault(p->pagetable, va);
     }
   }
   else if((which_dev = devintr()) != 0){
-    // ok
+    if(which_dev >= 2)
+      profsample(1, p->trapframe->epc, p->trapframe->s0);
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -100,6 +117,8 @@ usertrap(void)
       memmove(p->trapframeepc, p->trapframe, sizeof(struct trapframe));
       p->trapframe->epc = p->alarm_handler;
     }
+    // p holds none of its memory while it waits here.
+    p->atuser = 1;
     yield();
   }
 
@@ -118,6 +137,13 @@ usertrapret(void)
   // kerneltrap() to usertrap(), so turn off interrupts until
   // we're back in user space, where usertrap() is correct.
   intr_off();
+  p->atuser = 1;
+
+  // the time since usertrap(), or since the scheduler ran p,
+  // was spent in the kernel.
+  uint64 now = r_time();
+  p->stime += now - p->tstamp;
+  p->tstamp = now;
 
   // send syscalls, interrupts, and exceptions to uservec in trampoline.S
   uint64 trampoline_uservec = TRAMPOLINE + (uservec - trampoline);
@@ -143,13 +169,13 @@ usertrapret(void)
   w_sepc(p->trapframe->epc);
 
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = uvmactivate(p);
 
   // jump to userret in trampoline.S at the top of memory, which 
-  // switches to the user page table, restores user registers,
-  // and switches to user mode with sret.
+  // switches to the user page table, restores user registers
+  // from the trapframe, and switches to user mode with sret.
   uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64))trampoline_userret)(satp);
+  ((void (*)(uint64, uint64))trampoline_userret)(satp, p->tfva);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -173,6 +199,11 @@ kerneltrap()
     panic("kerneltrap");
   }
 
+  // kernelvec leaves s0 alone, so the s0 this frame saved is the
+  // frame pointer of the code that was interrupted.
+  if(which_dev >= 2)
+    profsample(0, sepc, *(uint64*)(r_fp() - 16));
+
   // give up the CPU if this is a timer interrupt.
   if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
     yield();
@@ -183,18 +214,28 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
+// bring ticks up to date with the time register. no hart
+// takes clock interrupts while idle, so any hart's tick does,
+// and so does the scheduler's idle loop.
 void
-clockintr()
+clockupdate(void)
 {
+  uint t = (r_time() - boottime) / TICKINTERVAL;
+
+  if(t == ticks)
+    return;
   acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
+  if(t - ticks < 0x80000000){
+    ticks = t;
+    wakeup(&ticks);
+  }
   release(&tickslock);
 }
 
 // check if it's an external interrupt or software interrupt,
 // and handle it.
 // returns 2 if timer interrupt,
+// 3 if a timer interrupt between clock ticks, for the profiler,
 // 1 if other device,
 // 0 if not recognized.
 int
@@ -232,89 +273,298 @@ devintr()
     return 1;
   } else if(scause == 0x8000000000000001L){
     // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // or from another hart asking for a TLB flush, forwarded
+    // by timervec in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
 
+    tlbservice();
+
+    // timervec sets the flag for a timer interrupt.
+    if(__sync_lock_test_and_set(&timer_scratch[cpuid()][5], 0) == 0)
+      return 1;
+
+    // run the timers that are due; it may not be time for a tick.
+    if(!hrintr())
+      return 1;
+
+    // while the profiler runs the tick is faster than the clock.
+    if(!proftick())
+      return 3;
+
+    clockupdate();
+
     return 2;
   } else {
     return 0;
   }
 }
 
-int pagefault(pagetable_t pagetable, uint64 va) {
-  // invalid va
-  if (va >= MAXVA) {
+// Map the page of vma at va from the page cache.
+// Caller must hold vma->ip's lock.
+static int
+mmappage(struct proc *proc, struct vma *vma, uint64 va, int write)
+{
+  struct page *pg;
+  char *pa;
+
+  uint offset = va - vma->vastart + vma->offset;
+  int perm = 0;
+  // Sv39 has no write-only pages.
+  if (vma->mode & (PROT_READ | PROT_WRITE)) {
+    perm |= PTE_R;
+  }
+  if (vma->mode & PROT_EXEC) {
+    perm |= PTE_X;
+  }
+
+  if ((pg = pread(vma->ip, offset/PGSIZE)) == 0) {
     return -1;
   }
-  
-  // struct proc *proc = myproc();
-  if (va >= MMAPBASE) {
-      struct proc *proc = myproc();
-      uint64 va = r_stval();
-      struct vma *vma = &proc->vma[(va-MMAPBASE)/MMAPMAX];
-      int offset = PGROUNDDOWN(va) - vma->vastart + vma->offset;
-      // printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), proc->pid);
-    // printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
-      uint64 *pa = (uint64 *)kalloc();
-      // printf("kalloc %p\n", pa);
-      int perm = 0;
-      if (vma->mode & PROT_READ) {
-        perm |= PTE_R;
-      }
-      if (vma->mode & PROT_WRITE) {
-        perm |= PTE_W;
-      }
-      if (vma->mode & PROT_EXEC) {
-        perm |= PTE_U;
-      }
-      memset(pa, 0, PGSIZE);
-      ilock(vma->ip);
-      readi(vma->ip, 0, (uint64)pa, offset, PGSIZE);
-      iunlock(vma->ip);
-      if (mappages(proc->pagetable, va, PGSIZE,  (uint64)pa, perm | PTE_U) < 0) {
-        return -1;
-      }
-      return 0;
-  }
-
-  pte_t *pte = (pte_t *)walk(pagetable, va, 0);
-  // va not mapped
-  if (pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 ) {
+  if ((vma->flags & MAP_PRIVATE) && write) {
+    // a private store gets its own copy right away.
+    if ((pa = kalloc()) == 0) {
+      prelse(pg);
+      return -1;
+    }
+    memmove(pa, pg->data, PGSIZE);
+    perm |= PTE_W;
+  } else {
+    // map the page cache's copy. Shared mappings are writable
+    // only after a store fault marks them dirty, private ones
+    // are copied on the first store.
+    pa = pg->data;
+    incmapcount(pa, 1);
+    if (write) {
+      perm |= PTE_W | PTE_D;
+    } else if ((vma->flags & MAP_PRIVATE) && (vma->mode & PROT_WRITE)) {
+      perm |= PTE_M;
+    }
+  }
+  prelse(pg);
+
+  if (mappages(proc->pagetable, va, PGSIZE, (uint64)pa, perm | PTE_U) < 0) {
+    kfree(pa);
     return -1;
   }
+  return 0;
+}
 
-  // handle for copyout. if copyout counters non cow page,
-  // just return 1
-  if ((*pte & PTE_W)) {
-    return 1;
+// Map a zeroed page of anonymous memory at va.
+static int
+anonfault(struct proc *proc, struct vma *vma, uint64 va)
+{
+  char *pa;
+  int perm = 0;
+
+  if (vma->mode & PROT_READ) {
+    perm |= PTE_R;
+  }
+  if (vma->mode & PROT_WRITE) {
+    perm |= PTE_R | PTE_W;
   }
+  if (vma->mode & PROT_EXEC) {
+    perm |= PTE_X;
+  }
+  if ((pa = kalloc()) == 0) {
+    return -1;
+  }
+  memset(pa, 0, PGSIZE);
+  if (mappages(proc->pagetable, va, PGSIZE, (uint64)pa, perm | PTE_U) < 0) {
+    kfree(pa);
+    return -1;
+  }
+  return 0;
+}
 
-  // if not a PTE_M page, this is no need to handle this kind of page fault
-  // just return -1
-  if ((*pte & PTE_M) == 0) {
+// Map the page of an mmap()ed file containing va, and, as the
+// mapping's advice says, the file pages around it that are not
+// mapped yet, so that scanning a file does not trap on every page.
+static int
+mmapfault(struct proc *proc, uint64 va, int access)
+{
+  struct vma *vma = vmalookup(proc, va);
+  int write = access == FAULT_WRITE;
+  uint64 a, start, end;
+  pte_t *pte;
+
+  if (vma == 0) {
+    return -1;
+  }
+  if (write && (vma->mode & PROT_WRITE) == 0) {
+    return -1;
+  }
+  if (access == FAULT_EXEC && (vma->mode & PROT_EXEC) == 0) {
+    return -1;
+  }
+  if (access == FAULT_READ && (vma->mode & (PROT_READ | PROT_WRITE)) == 0) {
     return -1;
   }
+  va = PGROUNDDOWN(va);
+  if (vma->f == 0) {
+    return anonfault(proc, vma, va);
+  }
 
-  // it is time to handle cow page
+  switch (vma->advice) {
+  case MADV_RANDOM:
+    start = end = va;
+    break;
+  case MADV_SEQUENTIAL:
+    start = va;
+    end = va + 2*NFAULTAROUND*PGSIZE;
+    break;
+  default:
+    start = va - (va - vma->vastart) % (NFAULTAROUND*PGSIZE);
+    end = start + NFAULTAROUND*PGSIZE;
+    break;
+  }
+  if (end > vma->vaend) {
+    end = vma->vaend;
+  }
+
+  ilockshared(vma->ip);
+  if (mmappage(proc, vma, va, write) < 0) {
+    iunlockshared(vma->ip);
+    return -1;
+  }
+  for (a = start; a < end; a += PGSIZE) {
+    if (a == va) {
+      continue;
+    }
+    // stop at end of file; those pages would only be zeros.
+    if (a - vma->vastart + vma->offset >= vma->ip->size) {
+      break;
+    }
+    pte = walk(proc->pagetable, a, 0);
+    if (pte && (*pte & (PTE_V | PTE_SWAP))) {
+      continue;
+    }
+    if (mmappage(proc, vma, a, 0) < 0) {
+      break;
+    }
+  }
+  iunlockshared(vma->ip);
+  return 0;
+}
+
+// First store to a MAP_SHARED page that was mapped by a load:
+// let it be written and remember it for write back.
+static int
+mmapdirty(struct proc *proc, uint64 va, pte_t *pte)
+{
+  struct vma *vma = vmalookup(proc, va);
+
+  if (vma == 0 || vma->f == 0) {
+    return -1;
+  }
+  if ((vma->flags & MAP_SHARED) == 0 || (vma->mode & PROT_WRITE) == 0) {
+    return -1;
+  }
+  *pte |= PTE_R | PTE_W | PTE_D;
+  uvmsfence(proc->pagetable, va);
+  return 0;
+}
+
+// Break copy-on-write sharing of the page pte refers to.
+static int
+cowfault(pagetable_t pagetable, uint64 va, pte_t *pte)
+{
   uint64 pa = PTE2PA(*pte);
+  char *mem;
 
   if (pa == 0) {
     return -1;
   }
-  pagetable = (pde_t*)kalloc();
-  if (pagetable == 0) {
+  // the other sharers are gone: no need to copy.
+  if (getmapcount((void *)pa) == 1) {
+    *pte = (*pte & ~PTE_M) | PTE_W;
+    uvmsfence(pagetable, va);
+    return 0;
+  }
+  if ((mem = kalloc()) == 0) {
     return -1;
   }
-
-  memmove((void *)pagetable, (void *)pa, PGSIZE);
-  *pte = (PTE_FLAGS(*pte) & ~PTE_M) | PTE_W | PA2PTE(pagetable);
+  memmove(mem, (void *)pa, PGSIZE);
+  *pte = (PTE_FLAGS(*pte) & ~PTE_M) | PTE_W | PA2PTE(mem);
+  uvmsfence(pagetable, va);
   kfree((void *)pa);
   return 0;
-}
\ No newline at end of file
+}
+
+// Handle a page fault at user virtual address va in pagetable,
+// or make sure va can be accessed before the kernel copies to or
+// from it. access is FAULT_READ for loads, FAULT_WRITE for stores
+// and FAULT_EXEC for instruction fetches. If the current process
+// has threads, the caller holds vmlock().
+// Returns 0 if the page is now accessible, -1 if the access
+// is not allowed.
+int
+pagefault(pagetable_t pagetable, uint64 va, int access)
+{
+  struct proc *p = leaderof(myproc());
+  int write = access == FAULT_WRITE;
+  pte_t *pte;
+
+  // invalid va
+  if (va >= MAXVA) {
+    return -1;
+  }
+
+  // make room now, while no PTE is in hand.
+  if (p && p->pagetable == pagetable) {
+    swapreserve();
+  }
+
+  pte = walk(pagetable, va, 0);
+  if (pte == 0 || (*pte & PTE_V) == 0) {
+    // not mapped yet, maybe it is paged in on demand.
+    if (p == 0 || p->pagetable != pagetable) {
+      return -1;
+    }
+    if (pte && (*pte & PTE_SWAP)) {
+      return swapin(pagetable, va, pte);
+    }
+    if (va >= MMAPBASE) {
+      return mmapfault(p, va, access);
+    }
+    if (va >= p->sz) {
+      return -1;
+    }
+    if (intext(p, va)) {
+      return textfault(p, va);
+    }
+    return uvmlazy(pagetable, va, write);
+  }
+
+  if ((*pte & PTE_U) == 0) {
+    return -1;
+  }
+
+  // a fetch or load the page does not allow would only fault again.
+  if ((access == FAULT_EXEC && (*pte & PTE_X) == 0) ||
+      (access == FAULT_READ && (*pte & PTE_R) == 0)) {
+    return -1;
+  }
+
+  if (!write || (*pte & PTE_W)) {
+    // a fault on a page that is there is a stale TLB entry.
+    if (p && p->pagetable == pagetable) {
+      sfence_vma_page(PGROUNDDOWN(va), ASID(p->asid));
+    }
+    return 0;
+  }
+
+  // if not a PTE_M page, this is no need to handle this kind of page fault
+  // just return -1, unless it is a clean MAP_SHARED page.
+  if ((*pte & PTE_M) == 0) {
+    if (va >= MMAPBASE && p && p->pagetable == pagetable) {
+      return mmapdirty(p, va, pte);
+    }
+    return -1;
+  }
+
+  // it is time to handle cow page
+  return cowfault(pagetable, va, pte);
+}
@@ -5,6 +5,8 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
 
 /*
  * the kernel's page table.
@@ -15,14 +17,59 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+static int nptpages;      // page-table pages in use
+
+// Allocate a zeroed page-table page.
+static pagetable_t
+ptalloc(void)
+{
+  pagetable_t pagetable;
+
+  if((pagetable = (pagetable_t)kalloc()) == 0)
+    return 0;
+  memset(pagetable, 0, PGSIZE);
+  __sync_fetch_and_add(&nptpages, 1);
+  return pagetable;
+}
+
+static void
+ptfree(pagetable_t pagetable)
+{
+  __sync_fetch_and_sub(&nptpages, 1);
+  kfree((void*)pagetable);
+}
+
+// Page-table pages in use, by all page tables.
+int
+ptpages(void)
+{
+  return nptpages;
+}
+
+// Account for delta user pages mapped at va in pagetable, if it is
+// the current process's. The tables that fork() and exec() build
+// are counted as a whole when they are done (see uvmcount()), and
+// swap and page merging keep the counts of the processes they
+// change themselves.
+static void
+uvmacct(pagetable_t pagetable, uint64 va, int delta)
+{
+  struct proc *p = leaderof(myproc());
+
+  if(p == 0 || p->pagetable != pagetable)
+    return;
+  p->mem.rss += delta;
+  if(va >= MMAPBASE)
+    p->mem.rssmmap += delta;
+}
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
 {
   pagetable_t kpgtbl;
 
-  kpgtbl = (pagetable_t) kalloc();
-  memset(kpgtbl, 0, PGSIZE);
+  kpgtbl = ptalloc();
 
   // uart registers
 
@@ -38,6 +85,9 @@ kvmmake(void)
   kvmmap(kpgtbl, 0x40000000L, 0x40000000L, 0x20000, PTE_R | PTE_W);
 #endif
 
+  // CLINT, for tlbshootdown()'s interprocessor interrupts.
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
@@ -57,11 +107,42 @@ kvmmake(void)
   return kpgtbl;
 }
 
-// Initialize the one kernel_pagetable
+// Address-space IDs.
+//
+// Each process's page table gets an ASID, so that the TLB can hold
+// the translations of the kernel (ASID 0) and of several processes
+// at once, and switching between them needs no flush. ASIDs are
+// handed out in order; when they run out a new generation starts,
+// each hart flushes its whole TLB once before running a process
+// with a new-generation ASID, and old processes get fresh ASIDs as
+// they next return to user space. p->asid holds the generation
+// above the ASID bits.
+//
+// Without hardware ASIDs every process runs with ASID 0 and the
+// trampoline flushes the TLB on every switch, as it used to.
+struct {
+  struct spinlock lock;
+  uint64 gen;   // current generation
+  uint64 next;  // next ASID to hand out in this generation
+  uint64 nasid; // number of ASIDs the hardware supports
+} asids;
+
+// A page of zeros, mapped copy-on-write for reads of heap
+// pages that have not been written yet. It is never freed:
+// its map count never drops below the reference kept here.
+static char *zeropage;
+
+// Initialize the one kernel_pagetable.
 void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  if((zeropage = kalloc()) == 0)
+    panic("kvminit: zeropage");
+  memset(zeropage, 0, PGSIZE);
+  initlock(&asids.lock, "asid");
+  asids.gen = 1;
+  asids.next = 1;
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -72,12 +153,255 @@ kvminithart()
   // wait for any previous writes to the page table memory to finish.
   sfence_vma();
 
+  // the ASID field keeps only as many bits as the hardware has.
+  w_satp(MAKE_SATP(kernel_pagetable) | SATP_ASID_MASK);
+  asids.nasid = ((r_satp() & SATP_ASID_MASK) >> SATP_ASID_SHIFT) + 1;
   w_satp(MAKE_SATP(kernel_pagetable));
 
   // flush stale entries from the TLB.
   sfence_vma();
 }
 
+// Return the satp value that runs p in user space on this hart,
+// giving p a current ASID and flushing whatever of this hart's
+// TLB might be stale for it. Called with interrupts off.
+// Threads run with their leader's ASID.
+uint64
+uvmactivate(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  uint64 gen, bit = 1L << cpuid();
+
+  p = leaderof(p);
+
+  if(asids.nasid < 2)
+    return MAKE_SATP(p->pagetable);
+
+  acquire(&asids.lock);
+  if((p->asid >> ASIDBITS) != asids.gen){
+    if(asids.next >= asids.nasid){
+      asids.gen++;
+      asids.next = 1;
+    }
+    p->asid = (asids.gen << ASIDBITS) | asids.next++;
+    p->tlbstale = 0;
+  }
+  gen = asids.gen;
+  release(&asids.lock);
+
+  if(c->asidgen != gen){
+    sfence_vma();
+    c->asidgen = gen;
+    __sync_fetch_and_and(&p->tlbstale, ~bit);
+  } else if(p->tlbstale & bit){
+    sfence_vma_asid(ASID(p->asid));
+    __sync_fetch_and_and(&p->tlbstale, ~bit);
+  }
+  return MAKE_SATP_ASID(p->pagetable, ASID(p->asid));
+}
+
+// TLB shootdown.
+//
+// Threads share their leader's page table and ASID, and may run on
+// several harts at once, so a change to a PTE they use must reach
+// the TLBs of all the harts running one of them (p->oncpu) before
+// it can be relied on: before the page is freed, say, or written
+// behind a read-only mapping. The hart making the change asks each
+// of them with an interprocessor interrupt and waits until they
+// have flushed. Harts that are not running the process flush
+// before they next do, as p->tlbstale says. Each hart's requests
+// are counted in c->tlbreq; tlbservice() flushes, and acknowledges
+// all of them at once in c->tlback.
+
+// Flush this hart's TLB if another hart asked. Called from
+// devintr() and from the loops that spin with interrupts off, so
+// that harts waiting for one another keep flushing.
+void
+tlbservice(void)
+{
+  struct cpu *c = mycpu();
+  uint req = __atomic_load_n(&c->tlbreq, __ATOMIC_ACQUIRE);
+
+  if(req != c->tlback){
+    sfence_vma();
+    __atomic_store_n(&c->tlback, req, __ATOMIC_RELEASE);
+  }
+}
+
+// Make the harts in mask flush their TLBs, and wait until they
+// have. The caller has made its PTE changes.
+static void
+tlbshootdown(uint64 mask)
+{
+  uint want[NCPU];
+  int i;
+
+  if(mask == 0)
+    return;
+  push_off();
+  mask &= ~(1L << cpuid());
+  __sync_synchronize();
+  for(i = 0; i < NCPU; i++){
+    if(mask & (1L << i)){
+      want[i] = __sync_add_and_fetch(&cpus[i].tlbreq, 1);
+      *(uint32*)CLINT_MSIP(i) = 1;
+    }
+  }
+  for(i = 0; i < NCPU; i++){
+    if(mask & (1L << i)){
+      while((int)(__atomic_load_n(&cpus[i].tlback, __ATOMIC_ACQUIRE) - want[i]) < 0)
+        tlbservice();
+    }
+  }
+  pop_off();
+}
+
+// A leaf PTE in pagetable changed: va's, or if va is -1, any. If
+// pagetable belongs to the current process, drop the TLB entries
+// on this hart now, and on other harts before the process next
+// runs there. Returns the other harts running the process right
+// now, for tlbshootdown(). Other page tables are either new, with
+// no ASID yet, or not in use.
+static uint64
+tlbdrop(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = leaderof(myproc());
+  uint64 others;
+
+  if(p == 0 || p->pagetable != pagetable)
+    return 0;
+  push_off();
+  others = ((1L << NCPU) - 1) & ~(1L << cpuid());
+  // without ASIDs, the trampoline flushes on the way to user space.
+  if(asids.nasid >= 2){
+    if(va == -1)
+      sfence_vma_asid(ASID(p->asid));
+    else
+      sfence_vma_page(va, ASID(p->asid));
+    __sync_fetch_and_or(&p->tlbstale, others);
+  }
+  // the PTE change before the look at oncpu, which the
+  // scheduler sets before the hart uses the page table.
+  __sync_synchronize();
+  others &= p->oncpu;
+  pop_off();
+  return others;
+}
+
+// The leaf PTE for va in pagetable changed: drop its TLB entries.
+void
+uvmsfence(pagetable_t pagetable, uint64 va)
+{
+  tlbshootdown(tlbdrop(pagetable, va));
+}
+
+// Leaf page-table pages shared at fork.
+//
+// fork() does not copy the leaf page-table pages that map the
+// parent's memory: the child's level-1 entries point at the
+// parent's leaf tables, which are reference counted with the
+// map counts, like data pages. Sv39 has no permission bits on
+// non-leaf entries, so both processes' entries for a shared table
+// are made invalid and marked PTE_M, and the first touch of the
+// 2MB a table maps faults. walk() then gives the process a table
+// of its own: a copy, with writable pages made copy-on-write, or
+// the table itself once no one else uses it. A child that calls
+// exec() right away copies nothing, and fork() of a big process
+// touches one entry per 2MB instead of every page.
+
+#define PTSPAN (512L*PGSIZE)   // bytes mapped by a leaf table
+
+// Release a leaf table no other process shares, and the pages it maps.
+static void
+freetable(pagetable_t pagetable)
+{
+  for(int i = 0; i < 512; i++){
+    if(pagetable[i] & PTE_V)
+      kfree((void*)PTE2PA(pagetable[i]));
+    else if(pagetable[i] & PTE_SWAP)
+      swapfree(PTE2SWAP(pagetable[i]));
+  }
+  ptfree(pagetable);
+}
+
+// pte is a level-1 entry for a shared leaf table.
+// Point it at a table of the caller's own.
+static int
+unsharetable(pte_t *pte)
+{
+  pagetable_t old = (pagetable_t)PTE2PA(*pte), new;
+  pte_t e;
+
+  if(getmapcount(old) > 1){
+    if((new = ptalloc()) == 0)
+      return -1;
+    for(int i = 0; i < 512; i++){
+      e = old[i];
+      if(e & PTE_V){
+        // the pages are now shared by both tables; the other
+        // users of old see the downgrade when they unshare.
+        if(e & PTE_W){
+          e = (e & ~PTE_W) | PTE_M;
+          old[i] = e;
+        }
+        incmapcount((void*)PTE2PA(e), 1);
+      } else if(e & PTE_SWAP){
+        swapdup(PTE2SWAP(e));
+      }
+      new[i] = e;
+    }
+    *pte = PA2PTE(new) | PTE_V;
+    if(kdropref(old) == 0)
+      freetable(old);
+    return 0;
+  }
+  *pte = PA2PTE(old) | PTE_V;
+  return 0;
+}
+
+// Return the level-1 entry for va, the one that points at va's
+// leaf table, creating the level-1 table if alloc is set. A table
+// created in the current process's page table is counted, as in
+// walk().
+static pte_t *
+walkl1(pagetable_t pagetable, uint64 va, int alloc)
+{
+  struct proc *p = myproc();
+  pagetable_t root = pagetable;
+  pte_t *pte = &pagetable[PX(2, va)];
+
+  if(*pte & PTE_V) {
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  } else {
+    if(!alloc || (pagetable = ptalloc()) == 0)
+      return 0;
+    *pte = PA2PTE(pagetable) | PTE_V;
+    if(p && p->pagetable == root)
+      leaderof(p)->mem.npt++;
+  }
+  return &pagetable[PX(1, va)];
+}
+
+// Drop pagetable's references to shared leaf tables below sz,
+// freeing those that no one else uses any more.
+static void
+uvmunshareall(pagetable_t pagetable, uint64 sz)
+{
+  pte_t *pte;
+  pagetable_t table;
+
+  for(uint64 a = 0; a < sz; a += PTSPAN){
+    if((pte = walkl1(pagetable, a, 0)) == 0)
+      continue;
+    if((*pte & PTE_V) == 0 && (*pte & PTE_M)){
+      table = (pagetable_t)PTE2PA(*pte);
+      if(kdropref(table) == 0)
+        freetable(table);
+      *pte = 0;
+    }
+  }
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -93,6 +417,9 @@ kvminithart()
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
+  struct proc *p = myproc();
+  pagetable_t root = pagetable;
+
   if(va >= MAXVA)
     panic("walk");
 
@@ -100,16 +427,51 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
       pagetable = (pagetable_t)PTE2PA(*pte);
+    } else if(level == 1 && (*pte & PTE_M)) {
+      // a leaf table shared since fork; make it ours.
+      if(unsharetable(pte) < 0)
+        return 0;
+      pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = ptalloc()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
+      if(p && p->pagetable == root)
+        leaderof(p)->mem.npt++;
     }
   }
   return &pagetable[PX(0, va)];
 }
 
+// Find the first address at or above *va, and below end, that has
+// a leaf page table. Sets *va to it and returns its PTE, or returns
+// 0 if there is none. Unlike walk(), never allocates or unshares a
+// table, so it can be used with p->lock held; tables shared since
+// fork are skipped.
+pte_t *
+walknext(pagetable_t pagetable, uint64 *va, uint64 end)
+{
+  uint64 a = *va;
+  pte_t *pte;
+
+  while(a < end){
+    pte = &pagetable[PX(2, a)];
+    if((*pte & PTE_V) == 0){
+      a = (a + 512*PTSPAN) & ~(512*PTSPAN - 1);
+      continue;
+    }
+    pte = &((pagetable_t)PTE2PA(*pte))[PX(1, a)];
+    if((*pte & PTE_V) == 0){
+      a = (a + PTSPAN) & ~(PTSPAN - 1);
+      continue;
+    }
+    *va = a;
+    return &((pagetable_t)PTE2PA(*pte))[PX(0, a)];
+  }
+  *va = end;
+  return 0;
+}
+
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
@@ -164,6 +526,8 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
     if(*pte & PTE_V)
       panic("mappages: remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
+    if(perm & PTE_U)
+      uvmacct(pagetable, a, 1);
     if(a == last)
       break;
     a += PGSIZE;
@@ -172,13 +536,69 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   return 0;
 }
 
+// Drop all of pagetable's TLB entries, after changes to many PTEs.
+void
+uvmsfenceall(pagetable_t pagetable)
+{
+  tlbshootdown(tlbdrop(pagetable, -1));
+}
+
+// The shared page of zeros that untouched heap is mapped to.
+void *
+uvmzeropage(void)
+{
+  return zeropage;
+}
+
+// Fault in the page at va of a heap that sbrk() grew without
+// allocating memory. A read maps the shared zero page,
+// copy-on-write; a write gets a zeroed page of its own.
+int
+uvmlazy(pagetable_t pagetable, uint64 va, int write)
+{
+  char *mem;
+
+  va = PGROUNDDOWN(va);
+  if(!write){
+    incmapcount(zeropage, 1);
+    if(mappages(pagetable, va, PGSIZE, (uint64)zeropage, PTE_R|PTE_U|PTE_M) != 0){
+      kfree(zeropage);
+      return -1;
+    }
+    return 0;
+  }
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+#define UNMAPBATCH 32   // pages uvmunmap() frees per shootdown
+
+// Shoot down the TLB entries of unmapped pages, then free them.
+static void
+unmapflush(uint64 *harts, uint64 *pa, int *n)
+{
+  tlbshootdown(*harts);
+  *harts = 0;
+  while(*n > 0)
+    kfree((void*)pa[--(*n)]);
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
-// Optionally free the physical memory.
+// page-aligned. Pages that were never faulted in are skipped.
+// Optionally free the physical memory. Pages are freed in
+// batches, each after one shootdown of the other harts' TLBs.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  struct proc *p = leaderof(myproc());
+  uint64 a, harts = 0, freed[UNMAPBATCH];
+  int nfreed = 0;
   pte_t *pte;
 
   if((va % PGSIZE) != 0)
@@ -186,17 +606,31 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
     if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
+    if((*pte & PTE_V) == 0){
+      if(*pte & PTE_SWAP){
+        if(do_free)
+          swapfree(PTE2SWAP(*pte));
+        *pte = 0;
+        if(p && p->pagetable == pagetable)
+          p->mem.swapped--;
+      }
+      continue;
+    }
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
+    if(*pte & PTE_U)
+      uvmacct(pagetable, a, -1);
+    uint64 pa = PTE2PA(*pte);
+    *pte = 0;
+    harts |= tlbdrop(pagetable, a);
     if(do_free){
-      uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
+      freed[nfreed++] = pa;
+      if(nfreed == UNMAPBATCH)
+        unmapflush(&harts, freed, &nfreed);
     }
-    *pte = 0;
   }
+  unmapflush(&harts, freed, &nfreed);
 }
 
 // create an empty user page table.
@@ -204,12 +638,7 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 pagetable_t
 uvmcreate()
 {
-  pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
-  if(pagetable == 0)
-    return 0;
-  memset(pagetable, 0, PGSIZE);
-  return pagetable;
+  return ptalloc();
 }
 
 // Load the user initcode into address 0 of pagetable,
@@ -291,7 +720,46 @@ freewalk(pagetable_t pagetable)
       panic("freewalk: leaf");
     }
   }
-  kfree((void*)pagetable);
+  ptfree(pagetable);
+}
+
+// Count the page-table pages of pagetable into m, and the user
+// pages too if leaves is set, for a process whose page table
+// fork() or exec() built. Leaf tables shared since fork count for
+// each process sharing them.
+void
+uvmcount(pagetable_t pagetable, struct memuse *m, int leaves)
+{
+  pagetable_t l1, l0;
+  pte_t pte;
+  uint64 va;
+
+  if(leaves)
+    memset(m, 0, sizeof(*m));
+  m->npt = 1;
+  for(int i = 0; i < 512; i++){
+    if((pagetable[i] & PTE_V) == 0)
+      continue;
+    l1 = (pagetable_t)PTE2PA(pagetable[i]);
+    m->npt++;
+    for(int j = 0; j < 512; j++){
+      if((l1[j] & (PTE_V|PTE_M)) == 0)
+        continue;
+      l0 = (pagetable_t)PTE2PA(l1[j]);
+      m->npt++;
+      for(int k = 0; leaves && k < 512; k++){
+        pte = l0[k];
+        va = ((uint64)i << PXSHIFT(2)) | ((uint64)j << PXSHIFT(1)) | ((uint64)k << PXSHIFT(0));
+        if((pte & (PTE_V|PTE_U)) == (PTE_V|PTE_U)){
+          m->rss++;
+          if(va >= MMAPBASE)
+            m->rssmmap++;
+        } else if((pte & PTE_V) == 0 && (pte & PTE_SWAP)){
+          m->swapped++;
+        }
+      }
+    }
+  }
 }
 
 // Free user memory pages,
@@ -299,6 +767,7 @@ freewalk(pagetable_t pagetable)
 void
 uvmfree(pagetable_t pagetable, uint64 sz)
 {
+  uvmunshareall(pagetable, PGROUNDUP(sz));
   if(sz > 0)
     uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1);
   freewalk(pagetable);
@@ -313,36 +782,70 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
+  pte_t *pte, *npte;
   uint64 pa, i;
   uint flags;
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+  int shared = 0;
+
+  for(i = 0; i < sz; ){
+    // share whole leaf tables, below the mmap() area.
+    if(i % PTSPAN == 0 && i + PTSPAN <= MMAPBASE){
+      pte = walkl1(old, i, 0);
+      if(pte == 0 || (*pte & (PTE_V|PTE_M)) == 0){
+        i += PTSPAN;  // nothing mapped
+        continue;
+      }
+      if((npte = walkl1(new, i, 1)) == 0)
+        goto err;
+      pa = PTE2PA(*pte);
+      incmapcount((void*)pa, 1);
+      *pte = PA2PTE(pa) | PTE_M;
+      *npte = PA2PTE(pa) | PTE_M;
+      shared = 1;
+      i += PTSPAN;
+      continue;
+    }
+
+    if((pte = walk(old, i, 0)) == 0 || (*pte & (PTE_V|PTE_SWAP)) == 0){
+      i += PGSIZE;
+      continue;  // not faulted in yet
+    }
+    if((*pte & PTE_V) == 0){
+      // swapped out: the child gets the slot too.
+      if((npte = walk(new, i, 1)) == 0)
+        goto err;
+      *npte = *pte;
+      swapdup(PTE2SWAP(*pte));
+      i += PGSIZE;
+      continue;
+    }
     pa = PTE2PA(*pte);
 
-    // printf("uvmcopy %p", PTE_FLAGS(*pte));
     flags = PTE_FLAGS(*pte);
     if (flags & PTE_W) {
       *pte &= ~PTE_W;
       *pte |= PTE_M;
+      uvmsfence(old, i);
     }
     flags = PTE_FLAGS(*pte);
-    // printf(" %p\n", PTE_FLAGS(*pte));
 
     if(mappages(new, i, PGSIZE, (uint64)pa, flags) != 0){
-      // kfree(mem);
       goto err;
     }
 
     incmapcount((void *)pa, 1);
+    i += PGSIZE;
   }
+  // the parent's own entries for shared tables are invalid now.
+  if(shared)
+    uvmsfenceall(old);
   return 0;
 
  err:
+  uvmunshareall(new, i);
   uvmunmap(new, 0, i / PGSIZE, 1);
+  if(shared)
+    uvmsfenceall(old);
   return -1;
 }
 
@@ -357,6 +860,142 @@ uvmclear(pagetable_t pagetable, uint64 va)
   if(pte == 0)
     panic("uvmclear");
   *pte &= ~PTE_U;
+  uvmsfence(pagetable, va);
+}
+
+// The PTE for va, or 0 if its leaf table is not there, for the
+// copies below: like walk(), but never unshares a table shared
+// since fork, which changes the page table and so is left to
+// pagefault().
+static pte_t *
+userpte(pagetable_t pagetable, uint64 va)
+{
+  if(va >= MAXVA)
+    return 0;
+  return walknext(pagetable, &va, va + 1);
+}
+
+// The user page mapped at va, or 0, as walkaddr() but with
+// userpte().
+static uint64
+useraddr(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte = userpte(pagetable, va);
+
+  if(pte == 0 || (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+    return 0;
+  return PTE2PA(*pte);
+}
+
+// Walk the frame pointers of user code from fp, as tracefrom()
+// does in the kernel, for the profiler. Only reads pages that are
+// mapped, and never faults. Returns the number of frames.
+int
+usertrace(pagetable_t pagetable, uint64 fp, uint64 *trace, int maxtrace)
+{
+  uint64 va, pa, w[2];
+  int i = 0, j;
+
+  while(i < maxtrace && fp >= 16 && !(fp & 7)){
+    // the caller's fp is at fp-16, the return address at fp-8.
+    for(j = 0; j < 2; j++){
+      va = fp - 16 + 8*j;
+      if((pa = useraddr(pagetable, PGROUNDDOWN(va))) == 0)
+        return i;
+      w[j] = *(uint64*)(pa + va % PGSIZE);
+    }
+    trace[i++] = w[1];
+    // callers' frames are further up the stack.
+    if(w[0] <= fp)
+      break;
+    fp = w[0];
+  }
+  return i;
+}
+
+// pagefault() for a copy to or from user memory. pagefault() can
+// sleep, reading text or swap, so a copy made with a spinlock held
+// fails instead; callers fault the memory in before taking the lock
+// (uvmprefault()). Threads sharing the memory serialize faults with
+// vmlock(), which comes before every other lock, so a copy made with
+// a sleep lock held only tries for it, and fails if another thread
+// has it.
+static int
+copyfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  int spin, r;
+
+  push_off();
+  spin = mycpu()->noff > 1;
+  pop_off();
+  if(spin)
+    return -1;
+  if(p == 0 || p->pagetable != pagetable)
+    return pagefault(pagetable, va, write);
+  if(vmlock(p, p->nsleeplock == 0) < 0)
+    return -1;
+  r = pagefault(pagetable, va, write);
+  vmunlock(p);
+  return r;
+}
+
+// The user page at va, made writable if need be, for copyout().
+// Returns 0 if it cannot be.
+static uint64
+userwritable(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  int i;
+
+  // a swapped-out copy-on-write page takes two faults.
+  for(i = 0; ; i++){
+    pte = userpte(pagetable, va);
+    if(pte && (*pte & (PTE_V|PTE_U|PTE_W)) == (PTE_V|PTE_U|PTE_W))
+      return PTE2PA(*pte);
+    if(i == 2 || copyfault(pagetable, va, 1) < 0)
+      return 0;
+  }
+}
+
+// The physical address of the user word at va, for futex.c, which
+// keys waiters on it. A copy-on-write page is copied first, so that
+// two processes have the same key only if they share the memory.
+// Returns 0 if va is not mapped.
+uint64
+userwordaddr(pagetable_t pagetable, uint64 va)
+{
+  uint64 va0 = PGROUNDDOWN(va), pa;
+
+  if((pa = userwritable(pagetable, va0)) == 0){
+    // a read-only mapping can be waited on too.
+    if((pa = useraddr(pagetable, va0)) == 0 && copyfault(pagetable, va0, 0) == 0)
+      pa = useraddr(pagetable, va0);
+    if(pa == 0)
+      return 0;
+  }
+  return pa + (va - va0);
+}
+
+// Fault in the current process's memory [va, va+len) for a copy
+// that will be made with locks held, such as a file read into it,
+// so that the copy need not fault, or take vmlock.
+void
+uvmprefault(uint64 va, uint64 len, int write)
+{
+  struct proc *p = myproc();
+  uint64 a, need = write ? PTE_V|PTE_U|PTE_W : PTE_V|PTE_U;
+  pte_t *pte;
+
+  if(va + len < va)
+    return;
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    pte = userpte(p->pagetable, a);
+    if(pte && (*pte & need) == need)
+      continue;
+    if(copyfault(p->pagetable, a, write) < 0)
+      return;
+  }
 }
 
 // Copy from kernel to user.
@@ -369,13 +1008,7 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    
-    if (pagefault(pagetable, dstva) < 0) {
-      return -1;
-    }
-
-    pa0 = walkaddr(pagetable, va0);
-
+    pa0 = userwritable(pagetable, va0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -401,7 +1034,9 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = useraddr(pagetable, va0);
+    if(pa0 == 0 && copyfault(pagetable, va0, 0) == 0)
+      pa0 = useraddr(pagetable, va0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -428,7 +1063,9 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = useraddr(pagetable, va0);
+    if(pa0 == 0 && copyfault(pagetable, va0, 0) == 0)
+      pa0 = useraddr(pagetable, va0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
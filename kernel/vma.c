@@ -0,0 +1,382 @@
+// Memory mappings.
+//
+// A process's mmap() regions are kept in p->vma[0..nvma-1], an
+// array sorted by address with no two regions overlapping. The
+// array starts out as the NVMA entries in struct proc and moves
+// into a page of its own when it outgrows them. Page faults find
+// their region by binary search; mmap() and munmap() split and
+// merge regions so that the array always describes exactly the
+// mapped ranges, in as few regions as possible.
+//
+// Regions live in [MMAPBASE, MMAPTOP), above anything sbrk() can
+// reach. A region's pages are mapped lazily by pagefault().
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+
+#define NVMAMAX (PGSIZE / sizeof(struct vma))
+
+void
+vmainit(struct proc *p)
+{
+  p->vma = p->vma0;
+  p->nvma = 0;
+  p->maxvma = NVMA;
+}
+
+// Free p's region array, which must be empty or only describe
+// mappings whose files are closed elsewhere.
+void
+vmafreetable(struct proc *p)
+{
+  if(p->vma && p->vma != p->vma0)
+    kfree((void*)p->vma);
+  vmainit(p);
+}
+
+// Make room for n more regions.
+static int
+vmagrow(struct proc *p, int n)
+{
+  struct vma *vma;
+
+  if(p->nvma + n <= p->maxvma)
+    return 0;
+  if(p->nvma + n > NVMAMAX)
+    return -1;
+  if((vma = (struct vma*)kalloc()) == 0)
+    return -1;
+  memmove(vma, p->vma, p->nvma * sizeof(struct vma));
+  p->vma = vma;
+  p->maxvma = NVMAMAX;
+  return 0;
+}
+
+// Index of the first region that ends above va,
+// or p->nvma if there is none.
+static int
+vmasearch(struct proc *p, uint64 va)
+{
+  int lo = 0, hi = p->nvma;
+
+  while(lo < hi){
+    int mid = (lo + hi) / 2;
+    if(p->vma[mid].vaend <= va)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Return the region containing va, or 0.
+struct vma*
+vmalookup(struct proc *p, uint64 va)
+{
+  int i = vmasearch(p, va);
+
+  if(i < p->nvma && p->vma[i].vastart <= va)
+    return &p->vma[i];
+  return 0;
+}
+
+// Insert v at index i, shifting the rest up.
+// Caller has made room with vmagrow().
+static struct vma*
+vmainsert(struct proc *p, int i, struct vma *v)
+{
+  memmove(&p->vma[i+1], &p->vma[i], (p->nvma - i) * sizeof(struct vma));
+  p->vma[i] = *v;
+  p->nvma++;
+  return &p->vma[i];
+}
+
+static void
+vmaremove(struct proc *p, int i)
+{
+  p->nvma--;
+  memmove(&p->vma[i], &p->vma[i+1], (p->nvma - i) * sizeof(struct vma));
+}
+
+// Can b, which starts where a ends, be folded into a?
+static int
+vmamergeable(struct vma *a, struct vma *b)
+{
+  if(a->vaend != b->vastart || a->f != b->f)
+    return 0;
+  if(a->mode != b->mode || a->flags != b->flags || a->advice != b->advice)
+    return 0;
+  if(a->f && a->offset + (a->vaend - a->vastart) != b->offset)
+    return 0;
+  return 1;
+}
+
+// Merge region i with its neighbours where possible.
+static void
+vmamerge(struct proc *p, int i)
+{
+  if(i+1 < p->nvma && vmamergeable(&p->vma[i], &p->vma[i+1])){
+    p->vma[i].vaend = p->vma[i+1].vaend;
+    if(p->vma[i+1].f)
+      fileclose(p->vma[i+1].f);
+    vmaremove(p, i+1);
+  }
+  if(i > 0 && vmamergeable(&p->vma[i-1], &p->vma[i])){
+    p->vma[i-1].vaend = p->vma[i].vaend;
+    if(p->vma[i].f)
+      fileclose(p->vma[i].f);
+    vmaremove(p, i);
+  }
+}
+
+// Unmap the pages of v in [va, end), writing dirty MAP_SHARED
+// pages back to the file first. The region itself is unchanged.
+static void
+vmadrop(struct proc *p, struct vma *v, uint64 va, uint64 end)
+{
+  struct inode *ip = v->f ? v->f->ip : 0;
+  uint64 a;
+  pte_t *pte;
+  uint off, n;
+
+  for(a = va; a < end; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    if(pte == 0 || (*pte & (PTE_V|PTE_SWAP)) == 0)
+      continue;
+    // a file page is the page cache's copy, so only the disk is
+    // behind; and only if the process stored to it.
+    if(ip && (v->flags & MAP_SHARED) && (*pte & PTE_D)){
+      off = a - v->vastart + v->offset;
+      begin_op();
+      ilock(ip);
+      if(off < ip->size){
+        n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+        writei(ip, 0, PTE2PA(*pte), off, n);
+      }
+      iunlock(ip);
+      end_op();
+    }
+    uvmunmap(p->pagetable, a, 1, 1);
+  }
+}
+
+// Cut [va, end) out of p's regions, unmapping their pages.
+// Returns -1 if a region would have to be split in two and
+// there is no room for the second half.
+static int
+vmacut(struct proc *p, uint64 va, uint64 end)
+{
+  struct vma *v, tail;
+  int i;
+
+  for(i = vmasearch(p, va); i < p->nvma && p->vma[i].vastart < end; ){
+    v = &p->vma[i];
+    if(v->vastart < va && v->vaend > end){
+      // split: keep [vastart, va) here and [end, vaend) after it.
+      if(vmagrow(p, 1) < 0)
+        return -1;
+      v = &p->vma[i];
+      tail = *v;
+      tail.vastart = end;
+      if(tail.f){
+        tail.offset += end - v->vastart;
+        filedup(tail.f);
+      }
+      vmadrop(p, v, va, end);
+      v->vaend = va;
+      vmainsert(p, i+1, &tail);
+      return 0;
+    }
+    if(v->vastart < va){
+      vmadrop(p, v, va, v->vaend);
+      v->vaend = va;
+      i++;
+    } else if(v->vaend > end){
+      vmadrop(p, v, v->vastart, end);
+      if(v->f)
+        v->offset += end - v->vastart;
+      v->vastart = end;
+      i++;
+    } else {
+      vmadrop(p, v, v->vastart, v->vaend);
+      if(v->f)
+        fileclose(v->f);
+      vmaremove(p, i);
+    }
+  }
+  return 0;
+}
+
+// Find len bytes of unmapped space in the mmap area,
+// preferring hint. Returns 0 if there is none.
+static uint64
+vmafindgap(struct proc *p, uint64 hint, uint64 len)
+{
+  uint64 va;
+  int i;
+
+  if(hint >= MMAPBASE && hint + len <= MMAPTOP && hint + len > hint){
+    i = vmasearch(p, hint);
+    if(i == p->nvma || p->vma[i].vastart >= hint + len)
+      return hint;
+  }
+  va = MMAPBASE;
+  for(i = 0; i < p->nvma; i++){
+    if(p->vma[i].vastart >= va + len)
+      break;
+    if(p->vma[i].vaend > va)
+      va = p->vma[i].vaend;
+  }
+  if(va + len > MMAPTOP)
+    return 0;
+  return va;
+}
+
+// Map len bytes of f at off, or anonymous memory if f is 0,
+// at addr if MAP_FIXED is set and anywhere free otherwise.
+// Takes a reference to f. Returns the address, or -1.
+uint64
+vmamap(struct proc *p, uint64 addr, uint64 len, int prot, int flags,
+       struct file *f, uint off)
+{
+  struct vma v, *nv;
+  int i;
+
+  if(len == 0 || len > MMAPTOP - MMAPBASE)
+    return -1;
+  len = PGROUNDUP(len);
+
+  if(flags & MAP_FIXED){
+    if(addr % PGSIZE != 0 || addr < MMAPBASE || addr + len > MMAPTOP)
+      return -1;
+    // make sure the new region, and the second half of one it
+    // lands in the middle of, will fit before unmapping anything.
+    if(vmagrow(p, 2) < 0)
+      return -1;
+    if(vmacut(p, addr, addr + len) < 0)
+      return -1;
+  } else {
+    if((addr = vmafindgap(p, PGROUNDDOWN(addr), len)) == 0)
+      return -1;
+    if(vmagrow(p, 1) < 0)
+      return -1;
+  }
+
+  memset(&v, 0, sizeof(v));
+  v.vastart = addr;
+  v.vaend = addr + len;
+  v.offset = off;
+  v.f = f;
+  v.ip = f ? f->ip : 0;
+  v.mode = prot;
+  v.flags = flags & (MAP_SHARED | MAP_PRIVATE | MAP_ANONYMOUS);
+  v.advice = MADV_NORMAL;
+  if(f)
+    filedup(f);
+
+  i = vmasearch(p, addr);
+  nv = vmainsert(p, i, &v);
+  vmamerge(p, nv - p->vma);
+  return addr;
+}
+
+// Unmap [va, va+len). Unmapping space that is not mapped is
+// not an error.
+int
+vmaunmap(struct proc *p, uint64 va, uint64 len)
+{
+  if(va % PGSIZE != 0 || va + len < va)
+    return -1;
+  return vmacut(p, va, PGROUNDUP(va + len));
+}
+
+// Unmap the pages of [va, va+len) but keep the mappings, so
+// that they are faulted in again from the file or as zeros.
+int
+vmadiscard(struct proc *p, uint64 va, uint64 len)
+{
+  uint64 end = PGROUNDUP(va + len);
+  struct vma *v;
+  int i;
+
+  if(va % PGSIZE != 0 || end < va)
+    return -1;
+  for(i = vmasearch(p, va); i < p->nvma && p->vma[i].vastart < end; i++){
+    v = &p->vma[i];
+    vmadrop(p, v, va > v->vastart ? va : v->vastart,
+            end < v->vaend ? end : v->vaend);
+  }
+  return 0;
+}
+
+// Unmap all of p's mappings, at exit and exec.
+void
+vmacloseall(struct proc *p)
+{
+  vmacut(p, MMAPBASE, MMAPTOP);
+}
+
+// Give np the same mappings as p, at fork. Pages that are already
+// mapped are shared; writable MAP_PRIVATE pages become
+// copy-on-write in both processes. Anonymous MAP_SHARED pages are
+// only shared if they exist, so they are all allocated first.
+int
+vmacopy(struct proc *np, struct proc *p)
+{
+  struct vma *v;
+  uint64 va, pa;
+  pte_t *pte, *npte;
+  int i;
+
+  if(p->nvma > np->maxvma){
+    if((np->vma = (struct vma*)kalloc()) == 0){
+      np->vma = np->vma0;
+      return -1;
+    }
+    np->maxvma = NVMAMAX;
+  }
+
+  for(i = 0; i < p->nvma; i++){
+    v = &p->vma[i];
+    np->vma[i] = *v;
+    if(v->f)
+      filedup(v->f);
+    np->nvma++;
+    for(va = v->vastart; va < v->vaend; va += PGSIZE){
+      pte = walk(p->pagetable, va, 0);
+      if(pte && (*pte & PTE_SWAP) && (v->flags & MAP_PRIVATE)){
+        // swapped out: the child gets the slot too.
+        if((npte = walk(np->pagetable, va, 1)) == 0)
+          return -1;
+        *npte = *pte;
+        swapdup(PTE2SWAP(*pte));
+        continue;
+      }
+      if(pte == 0 || (*pte & PTE_V) == 0){
+        if(v->f || (v->flags & MAP_SHARED) == 0)
+          continue;
+        if(pagefault(p->pagetable, va, 0) < 0)
+          return -1;
+        pte = walk(p->pagetable, va, 0);
+      }
+      if((v->flags & MAP_PRIVATE) && (*pte & PTE_W)){
+        *pte = (*pte & ~PTE_W) | PTE_M;
+        uvmsfence(p->pagetable, va);
+      }
+      pa = PTE2PA(*pte);
+      if(mappages(np->pagetable, va, PGSIZE, pa, PTE_FLAGS(*pte)) != 0)
+        return -1;
+      incmapcount((void*)pa, 1);
+    }
+  }
+  return 0;
+}
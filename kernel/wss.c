@@ -0,0 +1,156 @@
+// Working-set sampling.
+//
+// Every WSSPERIOD ticks, the scheduler calls wsssample(), which
+// walks the page table of each process that is not running, as
+// swap and merging do, and takes the accessed bits of its resident
+// pages. A page whose PTE_A is set was used during the period that
+// just ended: the sampler clears the bit and notes the period's
+// number against the physical page. A page's age is then the
+// number of periods since it was last used.
+//
+// Each process gets a histogram of its resident pages by age, in
+// power-of-two buckets: used in the last period, one period ago,
+// 2-3 ago, 4-7, and so on, the last bucket holding everything
+// older. Its working set is the pages used in the last WSSWINDOW
+// periods. memstat() reports both.
+//
+// The swap clock's second chance also relies on PTE_A, so the
+// sampler leaves a mark of its own behind when it clears one, and
+// wssreferenced() answers for either.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define WSSPERIOD  10   // ticks between samples
+#define WSSWINDOW  4    // periods in the working set; a power of 2
+
+extern struct proc proc[NPROC];
+extern uint ticks;
+
+struct {
+  struct spinlock lock;
+  uint last;              // ticks at the last sample
+  uint epoch;             // samples taken
+  uint seen[PGTOTAL];     // epoch a physical page was last used in
+  uchar ref[PGTOTAL];     // PTE_A taken since the swap clock looked
+  int hist[NWSSHIST];     // of all processes, at the last sample
+  int wss;
+} wss;
+
+void
+wssinit(void)
+{
+  initlock(&wss.lock, "wss");
+}
+
+static int
+bucket(uint age)
+{
+  int b;
+
+  for(b = 0; age > 0 && b < NWSSHIST-1; b++)
+    age >>= 1;
+  return b;
+}
+
+// Take the accessed bits of p's resident pages, and build its
+// histogram. Caller holds p->lock and wss.lock.
+static void
+wssscan(struct proc *p)
+{
+  struct wsinfo ws;
+  uint64 va = 0;
+  pte_t *pte;
+  uint ppn;
+  int cleared = 0;
+
+  memset(&ws, 0, sizeof(ws));
+  while((pte = walknext(p->pagetable, &va, MMAPTOP)) != 0){
+    if((*pte & (PTE_V|PTE_U)) == (PTE_V|PTE_U)){
+      ppn = PPN(PTE2PA(*pte));
+      if(*pte & PTE_A){
+        *pte &= ~PTE_A;
+        wss.seen[ppn] = wss.epoch;
+        wss.ref[ppn] = 1;
+        cleared = 1;
+      }
+      ws.hist[bucket(wss.epoch - wss.seen[ppn])]++;
+    }
+    va += PGSIZE;
+  }
+  for(int i = 0; i < NWSSHIST && (1 << i) <= WSSWINDOW; i++)
+    ws.size += ws.hist[i];
+  p->ws = ws;
+
+  for(int i = 0; i < NWSSHIST; i++)
+    wss.hist[i] += ws.hist[i];
+  wss.wss += ws.size;
+  // the hardware sets PTE_A again only once it reloads the PTE.
+  if(cleared)
+    p->tlbstale = (1L << NCPU) - 1;
+}
+
+// Called by the scheduler, with no locks held.
+void
+wsssample(void)
+{
+  struct proc *p;
+
+  if(ticks - wss.last < WSSPERIOD)
+    return;
+  acquire(&wss.lock);
+  if(ticks - wss.last < WSSPERIOD){
+    release(&wss.lock);
+    return;
+  }
+  wss.last = ticks;
+  wss.epoch++;
+  memset(wss.hist, 0, sizeof(wss.hist));
+  wss.wss = 0;
+
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(!threaded(p) && (p->state == SLEEPING || p->state == RUNNABLE))
+      wssscan(p);
+    release(&p->lock);
+  }
+  release(&wss.lock);
+}
+
+// For the swap clock: was the page that pte maps used since the
+// clock last looked at it? Clears the evidence either way.
+// Caller holds the lock of the process that pte belongs to.
+int
+wssreferenced(pte_t *pte)
+{
+  uint ppn = PPN(PTE2PA(*pte));
+  int used = wss.ref[ppn];
+
+  wss.ref[ppn] = 0;
+  if(*pte & PTE_A){
+    *pte &= ~PTE_A;
+    wss.seen[ppn] = wss.epoch;
+    used = 1;
+  }
+  return used;
+}
+
+// Print the system's working set into buf, for the statistics
+// device.
+int
+statswss(char *buf, int sz)
+{
+  int n, i;
+
+  n = snprintf(buf, sz, "wss: %d pages in the last %d periods of %d ticks; by age:",
+               wss.wss, WSSWINDOW, WSSPERIOD);
+  for(i = 0; i < NWSSHIST; i++)
+    n += snprintf(buf+n, sz-n, " %d", wss.hist[i]);
+  n += snprintf(buf+n, sz-n, "\n");
+  return n;
+}
@@ -0,0 +1,57 @@
+//
+// Print the CPU use of each process, or of those given: its nice
+// value, the time it has spent in user space and in the kernel,
+// its virtual runtime, by which the scheduler orders it, how
+// many times it has slept and been preempted, the harts it may
+// run on, the one it last ran on, and how many times it has moved
+// from one to another. Times are in ms.
+//
+// usage: cpustat [pid...]
+//
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/cpustat.h"
+#include "user/user.h"
+
+#define MS(t) ((int)((t) * NSPERTIME / 1000000))
+
+void
+printproc(int pid, struct cpustat *st)
+{
+  printf("%d\t%d\t%d\t%d\t%d\t%d\t%d\t%x\t%d\t%d\n", pid, st->nice, MS(st->utime),
+         MS(st->stime), MS(st->vruntime), (int)st->nvcsw, (int)st->nivcsw,
+         (int)st->cpumask, st->lastcpu, (int)st->nmigrate);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct cpustat st;
+  int i, pid, last;
+
+  printf("pid\tnice\tuser\tsys\tvrun\tslept\tpreempt\tmask\tcpu\tmoved\n");
+  if(argc > 1){
+    for(i = 1; i < argc; i++){
+      pid = atoi(argv[i]);
+      if(cpustat(pid, &st) < 0)
+        fprintf(2, "cpustat: no process %d\n", pid);
+      else
+        printproc(pid, &st);
+    }
+  } else {
+    // pids are handed out in order, so a child forked now gets
+    // one above every live process's; scan up to it.
+    if((last = fork()) == 0)
+      exit(0);
+    if(last < 0)
+      last = getpid() + 1;
+    else
+      wait(0);
+    for(pid = 1; pid < last; pid++){
+      if(cpustat(pid, &st) == 0)
+        printproc(pid, &st);
+    }
+  }
+  exit(0);
+}
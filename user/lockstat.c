@@ -0,0 +1,256 @@
+//
+// Print the kernel's lock profile, most contended first: totals for
+// each lock by name, then each site that acquires one. Sites are
+// kernel addresses, for addr2line -e kernel/kernel. Times are in
+// ticks of the time register, 100ns on qemu. With -h, also print
+// each site's wait and hold times by power-of-two bucket. With a
+// command, clear the profile, run the command, and report on what
+// it did.
+//
+// usage: lockstat [-s wait|hold|acq|cont] [-n count] [-h] [command [arg...]]
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define SZ    (64*1024)
+#define NSITE 384  // as NLOCKSITE in kernel/lockstat.c
+#define NHIST 20   // as NLOCKHIST in kernel/lockstat.c
+
+struct site {
+  uint64 pc;
+  int sleep;
+  uint64 nacq, nwait, wait, waitmax, hold, holdmax;
+  uint whist[NHIST], hhist[NHIST];
+  char *name;
+};
+
+char buf[SZ];
+struct site sites[NSITE], locks[NSITE];
+struct site *order[NSITE];
+int nsite, nlock;
+int hflag;
+char *key = "wait";
+
+// Read a decimal or 0x hex number at *sp, and the blanks after it.
+uint64
+num(char **sp)
+{
+  char *s = *sp;
+  uint64 n = 0;
+  int base = 10, d;
+
+  if(s[0] == '0' && s[1] == 'x'){
+    base = 16;
+    s += 2;
+  }
+  for(;; s++){
+    if(*s >= '0' && *s <= '9')
+      d = *s - '0';
+    else if(base == 16 && *s >= 'a' && *s <= 'f')
+      d = *s - 'a' + 10;
+    else
+      break;
+    n = n * base + d;
+  }
+  while(*s == ' ')
+    s++;
+  *sp = s;
+  return n;
+}
+
+// Parse the statistics device's "lockstat: " lines into sites[].
+void
+parse(char *s)
+{
+  struct site *st;
+  char *nl;
+  int i;
+
+  for(; *s; s = nl + 1){
+    if((nl = strchr(s, '\n')) == 0)
+      break;
+    *nl = 0;
+    if(memcmp(s, "lockstat: 0x", 12) != 0 || nsite == NSITE)
+      continue;
+    st = &sites[nsite++];
+    s += 10;
+    st->pc = num(&s);
+    st->sleep = num(&s);
+    st->nacq = num(&s);
+    st->nwait = num(&s);
+    st->wait = num(&s);
+    st->waitmax = num(&s);
+    st->hold = num(&s);
+    st->holdmax = num(&s);
+    for(i = 0; i < NHIST; i++)
+      st->whist[i] = num(&s);
+    for(i = 0; i < NHIST; i++)
+      st->hhist[i] = num(&s);
+    st->name = s;
+  }
+}
+
+// Sum the sites of each lock into locks[].
+void
+bylock(void)
+{
+  struct site *s, *l;
+  int i, j;
+
+  for(i = 0; i < nsite; i++){
+    s = &sites[i];
+    for(j = 0; j < nlock; j++)
+      if(locks[j].sleep == s->sleep && strcmp(locks[j].name, s->name) == 0)
+        break;
+    l = &locks[j];
+    if(j == nlock){
+      nlock++;
+      memset(l, 0, sizeof(*l));
+      l->name = s->name;
+      l->sleep = s->sleep;
+    }
+    l->nacq += s->nacq;
+    l->nwait += s->nwait;
+    l->wait += s->wait;
+    l->hold += s->hold;
+    if(s->waitmax > l->waitmax)
+      l->waitmax = s->waitmax;
+    if(s->holdmax > l->holdmax)
+      l->holdmax = s->holdmax;
+    for(j = 0; j < NHIST; j++){
+      l->whist[j] += s->whist[j];
+      l->hhist[j] += s->hhist[j];
+    }
+  }
+}
+
+uint64
+sortkey(struct site *s)
+{
+  if(strcmp(key, "hold") == 0)
+    return s->hold;
+  if(strcmp(key, "acq") == 0)
+    return s->nacq;
+  if(strcmp(key, "cont") == 0)
+    return s->nwait;
+  return s->wait;
+}
+
+// Print v right-aligned in a field w wide.
+void
+col(uint64 v, int w)
+{
+  char s[24];
+  int i = sizeof(s) - 1;
+
+  s[i] = 0;
+  do {
+    s[--i] = '0' + v % 10;
+    v /= 10;
+  } while(v);
+  for(w -= sizeof(s) - 1 - i; w > 0; w--)
+    printf(" ");
+  printf("%s", s + i);
+}
+
+void
+hist(char *what, uint *h)
+{
+  int i;
+
+  // bucket i holds times from 2^(i-1) up to 2^i.
+  printf("    %s", what);
+  for(i = 0; i < NHIST; i++)
+    if(h[i])
+      printf(" %d:%d", i ? 1 << (i-1) : 0, h[i]);
+  printf("\n");
+}
+
+void
+report(char *title, struct site *s, int n, int max, int site)
+{
+  int i, j, w;
+  struct site *t;
+
+  for(i = 0; i < n; i++){
+    // insertion sort, largest first.
+    t = &s[i];
+    for(j = i; j > 0 && sortkey(order[j-1]) < sortkey(t); j--)
+      order[j] = order[j-1];
+    order[j] = t;
+  }
+
+  printf("%s, by %s\n", title, key);
+  printf("name            %s     acquire      waited  wait total   wait max"
+         "  hold total   hold max\n", site ? "site              " : "");
+  for(i = 0; i < n && i < max; i++){
+    t = order[i];
+    printf("%s", t->name);
+    if(t->sleep)
+      printf("*");
+    for(w = strlen(t->name) + t->sleep; w < 16; w++)
+      printf(" ");
+    if(site)
+      printf("%p", t->pc);
+    col(t->nacq, 12);
+    col(t->nwait, 12);
+    col(t->wait, 12);
+    col(t->waitmax, 11);
+    col(t->hold, 12);
+    col(t->holdmax, 11);
+    printf("\n");
+    if(hflag && site){
+      hist("wait", t->whist);
+      hist("hold", t->hhist);
+    }
+  }
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, fd, pid, max = 10;
+
+  for(i = 1; i < argc && argv[i][0] == '-'; i++){
+    if(strcmp(argv[i], "-h") == 0)
+      hflag = 1;
+    else if(strcmp(argv[i], "-s") == 0 && i+1 < argc)
+      key = argv[++i];
+    else if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+      max = atoi(argv[++i]);
+    else {
+      fprintf(2, "usage: lockstat [-s wait|hold|acq|cont] [-n count] [-h] [command [arg...]]\n");
+      exit(1);
+    }
+  }
+
+  if(i < argc){
+    // any write to the statistics device clears the profile.
+    if((fd = open("statistics", O_WRONLY)) < 0 || write(fd, "", 1) != 1){
+      fprintf(2, "lockstat: cannot clear the profile\n");
+      exit(1);
+    }
+    close(fd);
+    if((pid = fork()) < 0){
+      fprintf(2, "lockstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[i], argv + i);
+      fprintf(2, "lockstat: exec %s failed\n", argv[i]);
+      exit(1);
+    }
+    wait(0);
+  }
+
+  n = statistics(buf, SZ - 1);
+  buf[n] = 0;
+  parse(buf);
+  bylock();
+  report("locks (* sleeplocks)", locks, nlock, max, 0);
+  report("sites", sites, nsite, max, 1);
+  exit(0);
+}
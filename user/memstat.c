@@ -0,0 +1,87 @@
+//
+// Print the system's memory use and that of each process,
+// in KB, from the kernel's counters. With -h, also print each
+// process's resident pages by how many sampling periods ago
+// they were last used.
+//
+// usage: memstat [-h] [pid...]
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+#define KB(pages) ((int)((pages) * (PGSIZE / 1024)))
+
+int hflag;
+
+void
+printsys(struct memstat *st)
+{
+  printf("total %d KB, free %d KB, shared %d KB\n",
+         KB(st->total), KB(st->free), KB(st->shared));
+  printf("page tables %d KB, page cache %d KB, ksm %d KB\n",
+         KB(st->pagetable), KB(st->pcache), KB(st->ksm));
+  printf("zswap %d KB in %d KB, swap %d/%d KB\n",
+         KB(st->zswap), KB(st->zpool), KB(st->swap), KB(st->swaptotal));
+}
+
+void
+printproc(int pid, struct memstat *st)
+{
+  int i;
+
+  printf("%d\t%d\t%d\t%d\t%d\t%d\n", pid, KB(st->rss), KB(st->rssmmap),
+         KB(st->swapped), KB(st->ptpages), KB(st->wss));
+  if(!hflag)
+    return;
+  // buckets: used in the last period, 1 ago, 2-3 ago, 4-7 ago, ...
+  printf("\tpages by age:");
+  for(i = 0; i < NWSSHIST; i++)
+    printf(" %d", (int)st->hist[i]);
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat st;
+  int i, pid, last;
+
+  if(argc > 1 && strcmp(argv[1], "-h") == 0){
+    hflag = 1;
+    argc--;
+    argv++;
+  }
+  if(memstat(0, &st) < 0){
+    fprintf(2, "memstat: failed\n");
+    exit(1);
+  }
+  printsys(&st);
+
+  printf("pid\trss\tmmap\tswapped\tpgtbl\twss\n");
+  if(argc > 1){
+    for(i = 1; i < argc; i++){
+      pid = atoi(argv[i]);
+      if(memstat(pid, &st) < 0)
+        fprintf(2, "memstat: no process %d\n", pid);
+      else
+        printproc(pid, &st);
+    }
+  } else {
+    // pids are handed out in order, so a child forked now gets
+    // one above every live process's; scan up to it.
+    if((last = fork()) == 0)
+      exit(0);
+    if(last < 0)
+      last = getpid() + 1;
+    else
+      wait(0);
+    for(pid = 1; pid < last; pid++){
+      if(memstat(pid, &st) == 0)
+        printproc(pid, &st);
+    }
+  }
+  exit(0);
+}
@@ -240,7 +240,112 @@ mmap_test(void)
   munmap(p2, PGSIZE);
   
   printf("test mmap two files: OK\n");
-  
+
+  printf("test mmap coherence\n");
+
+  //
+  // read() and write() go through the same pages that a
+  // MAP_SHARED mapping uses, so each sees the other's changes
+  // without a munmap() in between.
+  //
+  int fd3;
+  char buf[5];
+  if((fd3 = open("mmap3", O_RDWR|O_CREATE)) < 0)
+    err("open mmap3");
+  if(write(fd3, "abcde", 5) != 5)
+    err("write mmap3");
+  char *p3 = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd3, 0);
+  if(p3 == MAP_FAILED)
+    err("mmap mmap3");
+  p3[0] = 'X';
+  close(fd3);
+  if((fd3 = open("mmap3", O_RDWR)) < 0)
+    err("reopen mmap3");
+  if(read(fd3, buf, 5) != 5 || memcmp(buf, "Xbcde", 5) != 0)
+    err("read does not see store");
+  if(write(fd3, "!", 1) != 1)
+    err("write mmap3 (2)");
+  if(p3[5] != '!')
+    err("mapping does not see write");
+  close(fd3);
+  munmap(p3, PGSIZE);
+  unlink("mmap3");
+
+  printf("test mmap coherence: OK\n");
+
+  printf("test madvise\n");
+
+  //
+  // MADV_DONTNEED throws away a private copy; the next access
+  // sees the file again.
+  //
+  makefile(f);
+  if ((fd = open(f, O_RDONLY)) == -1)
+    err("open");
+  p = mmap(0, PGSIZE*2, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED)
+    err("mmap (6)");
+  close(fd);
+  if (madvise(p, PGSIZE*2, MADV_SEQUENTIAL) == -1)
+    err("madvise sequential");
+  if (madvise(p, PGSIZE*2, MADV_WILLNEED) == -1)
+    err("madvise willneed");
+  _v1(p);
+  p[0] = 'Z';
+  if (madvise(p, PGSIZE, MADV_DONTNEED) == -1)
+    err("madvise dontneed");
+  _v1(p);
+  if (madvise(p, PGSIZE, 99) != -1)
+    err("madvise bad advice should have failed");
+  if (munmap(p, PGSIZE*2) == -1)
+    err("munmap (6)");
+
+  printf("test madvise: OK\n");
+
+  printf("test mmap anonymous\n");
+
+  //
+  // anonymous memory, punching a hole in a mapping, MAP_FIXED
+  // into the hole, and more mappings than the old 16 slots.
+  //
+  char *a = mmap(0, PGSIZE*3, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (a == MAP_FAILED)
+    err("mmap anonymous");
+  for (i = 0; i < PGSIZE*3; i++) {
+    if (a[i] != 0)
+      err("anonymous memory not zero");
+    a[i] = i / PGSIZE + 1;
+  }
+  if (munmap(a + PGSIZE, PGSIZE) == -1)
+    err("munmap hole");
+  if (a[0] != 1 || a[PGSIZE*2] != 3)
+    err("split lost pages");
+  if (mmap(a + PGSIZE, PGSIZE, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != a + PGSIZE)
+    err("mmap fixed");
+  if (a[PGSIZE] != 0)
+    err("fixed mapping not zero");
+  // alternate the flags, so that neighbouring mappings are not
+  // merged and each one takes a region of its own.
+  char *m[40];
+  for (i = 0; i < 40; i++) {
+    m[i] = mmap(0, PGSIZE, PROT_READ | PROT_WRITE,
+                (i % 2 ? MAP_SHARED : MAP_PRIVATE) | MAP_ANONYMOUS, -1, 0);
+    if (m[i] == MAP_FAILED)
+      err("mmap many");
+    *m[i] = i;
+  }
+  for (i = 0; i < 40; i++) {
+    if (*m[i] != i)
+      err("many mappings mismatch");
+    if (munmap(m[i], PGSIZE) == -1)
+      err("munmap many");
+  }
+  if (munmap(a, PGSIZE*3) == -1)
+    err("munmap anonymous");
+
+  printf("test mmap anonymous: OK\n");
+
   printf("mmap_test: ALL OK\n");
 }
 
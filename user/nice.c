@@ -0,0 +1,32 @@
+//
+// Run a command with its nice value raised by inc, 10 if not
+// given, so that it gets less of the CPU; a negative inc gives
+// it more.
+//
+// usage: nice [-n inc] command [arg...]
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  int i = 1, inc = 10;
+
+  if(argc > 2 && strcmp(argv[1], "-n") == 0){
+    inc = atoi(argv[2] + (argv[2][0] == '-'));
+    if(argv[2][0] == '-')
+      inc = -inc;
+    i = 3;
+  }
+  if(i >= argc){
+    fprintf(2, "usage: nice [-n inc] command [arg...]\n");
+    exit(1);
+  }
+  // nice() keeps the value in range, so it cannot fail on us.
+  nice(inc);
+  exec(argv[i], argv + i);
+  fprintf(2, "nice: exec %s failed\n", argv[i]);
+  exit(1);
+}
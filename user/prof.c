@@ -0,0 +1,264 @@
+//
+// Profile a command: sample where each hart is, rate times per
+// clock tick, while the command runs, and print the functions the
+// samples fell in, most first, with the samples that were in the
+// function itself and those that were in it or in a function it
+// called. Kernel addresses are looked up in kernel.sym, user ones
+// in the .sym file of the program the process was running.
+//
+// usage: prof [-r rate] [-n count] command [arg...]
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/prof.h"
+#include "user/user.h"
+
+#define NTAB 16     // programs with symbols
+#define NFN  512    // functions seen
+
+struct symtab {
+  char prog[16];
+  int n;            // symbols, in address order
+  uint64 *addr;
+  char **name;
+};
+
+struct fn {
+  struct symtab *tab;
+  int sym;          // in tab, or -1 if there was none for pc
+  uint64 pc;
+  int self, total;
+};
+
+struct symtab tabs[NTAB];
+int ntab;
+struct fn fns[NFN];
+int nfn;
+int nsample, nuser;
+
+uint64
+hex(char **sp)
+{
+  char *s = *sp;
+  uint64 n = 0;
+
+  for(;; s++){
+    if(*s >= '0' && *s <= '9')
+      n = n * 16 + *s - '0';
+    else if(*s >= 'a' && *s <= 'f')
+      n = n * 16 + *s - 'a' + 10;
+    else
+      break;
+  }
+  *sp = s;
+  return n;
+}
+
+// Read prog.sym, as the Makefile makes it: lines of an address
+// in hex and a name. File and section names have dots in them,
+// and are left out.
+void
+readsyms(struct symtab *t, char *prog)
+{
+  char path[32], *text, *s, *nl, *name;
+  struct stat st;
+  int fd, j, n;
+  uint64 a;
+
+  strcpy(path, prog);
+  strcpy(path + strlen(path), ".sym");
+  if((fd = open(path, O_RDONLY)) < 0)
+    return;
+  if(fstat(fd, &st) < 0 || (text = malloc(st.size + 1)) == 0){
+    close(fd);
+    return;
+  }
+  n = read(fd, text, st.size);
+  close(fd);
+  if(n < 0)
+    return;
+  text[n] = 0;
+
+  for(n = 0, s = text; *s; s++)
+    n += *s == '\n';
+  t->addr = malloc(n * sizeof(uint64));
+  t->name = malloc(n * sizeof(char*));
+  for(s = text; (nl = strchr(s, '\n')) != 0; s = nl + 1){
+    *nl = 0;
+    a = hex(&s);
+    if(*s++ != ' ' || strchr(s, '.') != 0)
+      continue;
+    name = s;
+    // insertion sort, by address.
+    for(j = t->n; j > 0 && t->addr[j-1] > a; j--){
+      t->addr[j] = t->addr[j-1];
+      t->name[j] = t->name[j-1];
+    }
+    t->addr[j] = a;
+    t->name[j] = name;
+    t->n++;
+  }
+}
+
+struct symtab*
+symtab(char *prog)
+{
+  struct symtab *t;
+
+  for(t = tabs; t < &tabs[ntab]; t++)
+    if(strcmp(t->prog, prog) == 0)
+      return t;
+  if(ntab == NTAB)
+    return 0;
+  t = &tabs[ntab++];
+  strcpy(t->prog, prog);
+  readsyms(t, prog);
+  return t;
+}
+
+// The symbol pc is in: the last one at or below it.
+int
+lookup(struct symtab *t, uint64 pc)
+{
+  int lo = 0, hi, mid;
+
+  if(t == 0 || t->n == 0 || pc < t->addr[0])
+    return -1;
+  hi = t->n;
+  while(hi - lo > 1){
+    mid = (lo + hi) / 2;
+    if(t->addr[mid] <= pc)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+struct fn*
+fnof(struct symtab *t, uint64 pc)
+{
+  struct fn *f;
+  int sym = lookup(t, pc);
+
+  for(f = fns; f < &fns[nfn]; f++)
+    if(f->tab == t && f->sym == sym && (sym >= 0 || f->pc == pc))
+      return f;
+  if(nfn == NFN)
+    return 0;
+  f = &fns[nfn++];
+  f->tab = t;
+  f->sym = sym;
+  f->pc = pc;
+  return f;
+}
+
+void
+account(struct sample *s)
+{
+  struct fn *seen[1+NPROFTRACE], *f;
+  struct symtab *t;
+  int i, j, n = 0;
+
+  nsample++;
+  nuser += s->user;
+  t = symtab(s->user ? s->name : "kernel");
+  for(i = -1; i < s->ntrace && i < NPROFTRACE; i++){
+    // a return address is just past its call.
+    if((f = fnof(t, i < 0 ? s->pc : s->trace[i] - 1)) == 0)
+      continue;
+    if(i < 0)
+      f->self++;
+    for(j = 0; j < n && seen[j] != f; j++)
+      ;
+    if(j == n){
+      seen[n++] = f;
+      f->total++;
+    }
+  }
+}
+
+void
+report(int max)
+{
+  struct fn *order[NFN], *f;
+  int i, j;
+
+  for(i = 0; i < nfn; i++){
+    f = &fns[i];
+    for(j = i; j > 0 && order[j-1]->self < f->self; j--)
+      order[j] = order[j-1];
+    order[j] = f;
+  }
+
+  printf("%d samples, %d in user code\n", nsample, nuser);
+  if(nsample == 0)
+    return;
+  printf("self%%\tself\ttotal\tfunction\n");
+  for(i = 0; i < nfn && i < max; i++){
+    f = order[i];
+    printf("%d\t%d\t%d\t", f->self * 100 / nsample, f->self, f->total);
+    if(f->sym >= 0)
+      printf("%s", f->tab->name[f->sym]);
+    else
+      printf("%p", f->pc);
+    printf(" (%s)\n", f->tab ? f->tab->prog : "?");
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct sample buf[32];
+  int i, n, fd, pid, w, reader, rate = 10, max = 20, zero = 0;
+
+  for(i = 1; i < argc && argv[i][0] == '-'; i++){
+    if(strcmp(argv[i], "-r") == 0 && i+1 < argc)
+      rate = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+      max = atoi(argv[++i]);
+    else
+      break;
+  }
+  if(i == argc || rate <= 0){
+    fprintf(2, "usage: prof [-r rate] [-n count] command [arg...]\n");
+    exit(1);
+  }
+
+  if((fd = open("prof", O_RDWR)) < 0 || write(fd, &rate, sizeof(rate)) != sizeof(rate)){
+    fprintf(2, "prof: cannot start the profiler\n");
+    exit(1);
+  }
+
+  // a reader takes the samples as they come, until the profiler
+  // stops, and then reports.
+  if((reader = fork()) < 0){
+    fprintf(2, "prof: fork failed\n");
+    exit(1);
+  }
+  if(reader == 0){
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+      for(i = 0; i < n / sizeof(buf[0]); i++)
+        account(&buf[i]);
+    report(max);
+    exit(0);
+  }
+
+  if((pid = fork()) < 0){
+    fprintf(2, "prof: fork failed\n");
+  } else if(pid == 0){
+    close(fd);
+    exec(argv[i], argv + i);
+    fprintf(2, "prof: exec %s failed\n", argv[i]);
+    exit(1);
+  } else {
+    while((w = wait(0)) != pid && w >= 0)
+      ;
+  }
+
+  write(fd, &zero, sizeof(zero));
+  wait(0);
+  exit(0);
+}
@@ -52,7 +52,9 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+int simplecmd(char*);
 void runcmd(struct cmd*) __attribute__((noreturn));
+void spawncmd(struct cmd*);
 
 // Execute cmd.  Never returns.
 void
@@ -131,6 +133,54 @@ runcmd(struct cmd *cmd)
   exit(0);
 }
 
+// Run a command with only words and redirections without
+// forking the shell: spawn() the program with the redirected
+// files as its descriptors 0-2.
+void
+spawncmd(struct cmd *cmd)
+{
+  int fds[3] = {0, 1, 2};
+  int opened[3] = {0, 0, 0};
+  int fd, i;
+  struct cmd *c;
+  struct redircmd *rcmd;
+  struct execcmd *ecmd;
+
+  // runcmd() applies the outermost redirection, the last one on
+  // the line, first; the inner ones replace it.
+  for(c = cmd; c->type == REDIR; c = rcmd->cmd){
+    rcmd = (struct redircmd*)c;
+    if((fd = open(rcmd->file, rcmd->mode)) < 0){
+      fprintf(2, "open %s failed\n", rcmd->file);
+      goto out;
+    }
+    if(opened[rcmd->fd])
+      close(fds[rcmd->fd]);
+    fds[rcmd->fd] = fd;
+    opened[rcmd->fd] = 1;
+  }
+
+  ecmd = (struct execcmd*)c;
+  if(ecmd->argv[0] == 0)
+    goto out;
+  if(spawn(ecmd->argv[0], ecmd->argv, fds, 3) < 0)
+    fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+  else
+    wait(0);
+
+ out:
+  for(i = 0; i < 3; i++)
+    if(opened[i])
+      close(fds[i]);
+  // only EXEC and REDIR nodes here.
+  while(cmd->type == REDIR){
+    c = ((struct redircmd*)cmd)->cmd;
+    free(cmd);
+    cmd = c;
+  }
+  free(cmd);
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -165,6 +215,10 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
+    if(simplecmd(buf)){
+      spawncmd(parsecmd(buf));
+      continue;
+    }
     if(fork1() == 0)
       runcmd(parsecmd(buf));
     wait(0);
@@ -342,6 +396,34 @@ parsecmd(char *s)
   return cmd;
 }
 
+// Is s just words and redirections, which parsecmd() will
+// parse without error? Parse errors exit, so the shell itself
+// only parses these.
+int
+simplecmd(char *s)
+{
+  char *es = s + strlen(s);
+  int tok, nargs = 0;
+
+  while((tok = gettoken(&s, es, 0, 0)) != 0){
+    switch(tok){
+    case 'a':
+      if(++nargs >= MAXARGS)
+        return 0;
+      break;
+    case '<':
+    case '>':
+    case '+':
+      if(gettoken(&s, es, 0, 0) != 'a')
+        return 0;
+      break;
+    default:
+      return 0;
+    }
+  }
+  return nargs > 0;
+}
+
 struct cmd*
 parseline(char **ps, char *es)
 {
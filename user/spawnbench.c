@@ -0,0 +1,87 @@
+//
+// fork()+exec() versus spawn() latency: start a program that exits
+// at once and wait for it, n times each way, first from a small
+// process and then from one with a few MB of heap that fork() has
+// to copy-on-write. Times are in ticks of the time register.
+//
+// usage: spawnbench [iterations]
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define HEAP (4*1024*1024)
+
+static inline uint64
+rdtime(void)
+{
+  uint64 x;
+  asm volatile("rdtime %0" : "=r" (x));
+  return x;
+}
+
+char *args[] = { "spawnbench", "-exit", 0 };
+
+void
+run(char *what, int n)
+{
+  uint64 t0, tfork, tspawn;
+  int i, pid;
+
+  t0 = rdtime();
+  for(i = 0; i < n; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("spawnbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(args[0], args);
+      printf("spawnbench: exec failed\n");
+      exit(1);
+    }
+    wait(0);
+  }
+  tfork = rdtime() - t0;
+
+  t0 = rdtime();
+  for(i = 0; i < n; i++){
+    if(spawn(args[0], args, 0, -1) < 0){
+      printf("spawnbench: spawn failed\n");
+      exit(1);
+    }
+    wait(0);
+  }
+  tspawn = rdtime() - t0;
+
+  printf("%s: fork+exec %d ticks, spawn %d ticks per program\n",
+         what, (int)(tfork / n), (int)(tspawn / n));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 100;
+  char *p;
+
+  if(argc > 1 && strcmp(argv[1], "-exit") == 0)
+    exit(0);
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n <= 0){
+    fprintf(2, "usage: spawnbench [iterations]\n");
+    exit(1);
+  }
+
+  run("small parent", n);
+
+  if((p = sbrk(HEAP)) == (char*)-1){
+    printf("spawnbench: sbrk failed\n");
+    exit(1);
+  }
+  for(int i = 0; i < HEAP; i += PGSIZE)
+    p[i] = 1;
+  run("4MB parent", n);
+  exit(0);
+}
@@ -0,0 +1,52 @@
+//
+// Run a command on only the harts in mask, or, with -p, move
+// process pid to them. mask is in hex: bit n for hart n.
+//
+// usage: taskset mask command [arg...]
+//        taskset -p mask pid
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+uint64
+hex(char *s)
+{
+  uint64 n = 0;
+
+  if(s[0] == '0' && s[1] == 'x')
+    s += 2;
+  for(;; s++){
+    if(*s >= '0' && *s <= '9')
+      n = n * 16 + *s - '0';
+    else if(*s >= 'a' && *s <= 'f')
+      n = n * 16 + *s - 'a' + 10;
+    else
+      break;
+  }
+  return n;
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc == 4 && strcmp(argv[1], "-p") == 0){
+    if(setaffinity(atoi(argv[3]), hex(argv[2])) < 0){
+      fprintf(2, "taskset: cannot set the harts of %s\n", argv[3]);
+      exit(1);
+    }
+    exit(0);
+  }
+  if(argc < 3){
+    fprintf(2, "usage: taskset mask command [arg...]\n"
+               "       taskset -p mask pid\n");
+    exit(1);
+  }
+  if(setaffinity(0, hex(argv[1])) < 0){
+    fprintf(2, "taskset: no hart in %s\n", argv[1]);
+    exit(1);
+  }
+  exec(argv[2], argv + 2);
+  fprintf(2, "taskset: exec %s failed\n", argv[2]);
+  exit(1);
+}
@@ -0,0 +1,74 @@
+//
+// CPU-bound speedup from clone() threads: split a fixed amount of
+// arithmetic among 1, 2, 4, ... threads, up to n, and time each
+// run in ticks of the time register. With enough harts the time
+// should fall about in proportion to the number of threads.
+//
+// usage: threadbench [threads]
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define WORK (1 << 26)  // loop iterations in all
+
+static inline uint64
+rdtime(void)
+{
+  uint64 x;
+  asm volatile("rdtime %0" : "=r" (x));
+  return x;
+}
+
+static int nthread;
+static volatile uint64 sums[64];
+
+void
+worker(void *arg)
+{
+  int i = (int)(uint64)arg, n;
+  uint64 x = i + 1;
+
+  for(n = 0; n < WORK / nthread; n++)
+    x = x * 6364136223846793005UL + 1442695040888963407UL;
+  sums[i] = x;
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int max = 4, i;
+  uint64 t0, t1, base = 0;
+  char *stacks;
+
+  if(argc > 1)
+    max = atoi(argv[1]);
+  if(max <= 0 || max > 64){
+    fprintf(2, "usage: threadbench [threads]\n");
+    exit(1);
+  }
+  if((stacks = sbrk(max*PGSIZE)) == (char*)-1){
+    printf("threadbench: sbrk failed\n");
+    exit(1);
+  }
+
+  for(nthread = 1; nthread <= max; nthread *= 2){
+    t0 = rdtime();
+    for(i = 0; i < nthread; i++){
+      if(clone(worker, (void*)(uint64)i, stacks + (i+1)*PGSIZE) < 0){
+        printf("threadbench: clone failed\n");
+        exit(1);
+      }
+    }
+    for(i = 0; i < nthread; i++)
+      wait(0);
+    t1 = rdtime() - t0;
+    if(nthread == 1)
+      base = t1;
+    printf("%d threads: %d ticks, speedup %d.%d\n", nthread, (int)t1,
+           (int)(base / t1), (int)(base * 10 / t1 % 10));
+  }
+  exit(0);
+}
@@ -1,27 +1,207 @@
+//
+// Trace the system calls in mask (bit n for SYS_ number n) that a
+// command and its children make, and print, for each kind of call,
+// how many there were and their latencies: mean, max, and how many
+// fell in each power-of-two bucket. Latencies are in ticks of the
+// time register, 100ns on qemu. With -v, also print each call as
+// it comes: pid, name, the first three arguments, the return value
+// and the latency. mask is decimal, or hex after 0x, and may be
+// wider than an int, for system calls numbered 31 and up.
+//
+// usage: trace [-v] mask command [arg...]
+//
+
 #include "kernel/param.h"
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/syscall.h"
+#include "kernel/systrace.h"
 #include "user/user.h"
 
+#define NSYS  64
+#define NHIST 24
+
+char *names[NSYS] = {
+[SYS_fork]    "fork",
+[SYS_exit]    "exit",
+[SYS_wait]    "wait",
+[SYS_pipe]    "pipe",
+[SYS_read]    "read",
+[SYS_kill]    "kill",
+[SYS_exec]    "exec",
+[SYS_fstat]   "fstat",
+[SYS_chdir]   "chdir",
+[SYS_dup]     "dup",
+[SYS_getpid]  "getpid",
+[SYS_sbrk]    "sbrk",
+[SYS_sleep]   "sleep",
+[SYS_uptime]  "uptime",
+[SYS_open]    "open",
+[SYS_write]   "write",
+[SYS_mknod]   "mknod",
+[SYS_unlink]  "unlink",
+[SYS_link]    "link",
+[SYS_mkdir]   "mkdir",
+[SYS_close]   "close",
+[SYS_trace]   "trace",
+[SYS_sysinfo] "sysinfo",
+[SYS_pgaccess] "pgaccess",
+[SYS_sigalarm] "sigalarm",
+[SYS_sigreturn] "sigreturn",
+[SYS_connect] "connect",
+[SYS_symlink] "symlink",
+[SYS_mmap] "mmap",
+[SYS_munmap] "munmap",
+[SYS_madvise] "madvise",
+[SYS_spawn] "spawn",
+[SYS_memstat] "memstat",
+[SYS_clone] "clone",
+[SYS_nanosleep] "nanosleep",
+[SYS_setpriority] "setpriority",
+[SYS_cpustat] "cpustat",
+[SYS_setaffinity] "setaffinity",
+[SYS_futex_wait] "futex_wait",
+[SYS_futex_wake] "futex_wake",
+};
+
+struct lat {
+  uint64 n, tot, max;
+  uint hist[NHIST];
+} lats[NSYS];
+
+int vflag;
+
+// mask may not fit atoi()'s int.
+uint64
+parsemask(char *s)
+{
+  uint64 m = 0;
+  int d;
+
+  if(s[0] == '0' && (s[1] == 'x' || s[1] == 'X')){
+    for(s += 2; ; s++){
+      if(*s >= '0' && *s <= '9')
+        d = *s - '0';
+      else if(*s >= 'a' && *s <= 'f')
+        d = *s - 'a' + 10;
+      else if(*s >= 'A' && *s <= 'F')
+        d = *s - 'A' + 10;
+      else
+        break;
+      m = m*16 + d;
+    }
+    return m;
+  }
+  for(; *s >= '0' && *s <= '9'; s++)
+    m = m*10 + *s - '0';
+  return m;
+}
+
+char*
+name(int num)
+{
+  if(num >= 0 && num < NSYS && names[num])
+    return names[num];
+  return "?";
+}
+
+void
+account(struct sysrec *r)
+{
+  struct lat *l;
+  uint64 t = r->exit - r->entry, u;
+  int b;
+
+  if(vflag)
+    printf("%d: syscall %s(%p, %p, %p) -> %d  %d\n", r->pid, name(r->num),
+           r->arg[0], r->arg[1], r->arg[2], (int)r->ret, (int)t);
+  if(r->num < 0 || r->num >= NSYS)
+    return;
+  l = &lats[r->num];
+  l->n++;
+  l->tot += t;
+  if(t > l->max)
+    l->max = t;
+  // bucket b holds times from 2^(b-1) up to 2^b.
+  for(b = 0, u = t; u > 0 && b < NHIST-1; b++)
+    u >>= 1;
+  l->hist[b]++;
+}
+
+void
+report(void)
+{
+  struct lat *l;
+  int num, b;
+
+  printf("syscall\t\tcalls\tmean\tmax\n");
+  for(num = 0; num < NSYS; num++){
+    l = &lats[num];
+    if(l->n == 0)
+      continue;
+    printf("%s\t%s%d\t%d\t%d\n", name(num), strlen(name(num)) < 8 ? "\t" : "",
+           (int)l->n, (int)(l->tot / l->n), (int)l->max);
+    printf("   ");
+    for(b = 0; b < NHIST; b++)
+      if(l->hist[b])
+        printf(" %d:%d", b ? 1 << (b-1) : 0, l->hist[b]);
+    printf("\n");
+  }
+}
+
 int
 main(int argc, char *argv[])
 {
-  int i;
-  char *nargv[MAXARG];
+  struct sysrec buf[16];
+  int i, n, fd, pid, w, reader, on = 1, off = 0;
+
+  i = 1;
+  if(i < argc && strcmp(argv[i], "-v") == 0){
+    vflag = 1;
+    i++;
+  }
+  if(argc - i < 2 || argv[i][0] < '0' || argv[i][0] > '9'){
+    fprintf(2, "usage: trace [-v] mask command [arg...]\n");
+    exit(1);
+  }
 
-  if(argc < 3 || (argv[1][0] < '0' || argv[1][0] > '9')){
-    fprintf(2, "Usage: %s mask command\n", argv[0]);
+  if((fd = open("systrace", O_RDWR)) < 0 || write(fd, &on, sizeof(on)) != sizeof(on)){
+    fprintf(2, "trace: cannot turn tracing on\n");
     exit(1);
   }
 
-  if (trace(atoi(argv[1])) < 0) {
-    fprintf(2, "%s: trace failed\n", argv[0]);
+  // a reader takes the records as they come, until tracing is
+  // turned off, and then reports.
+  if((reader = fork()) < 0){
+    fprintf(2, "trace: fork failed\n");
     exit(1);
   }
+  if(reader == 0){
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+      for(i = 0; i < n / sizeof(buf[0]); i++)
+        account(&buf[i]);
+    report();
+    exit(0);
+  }
 
-  for(i = 2; i < argc && i < MAXARG; i++){
-    nargv[i-2] = argv[i];
+  if((pid = fork()) < 0){
+    fprintf(2, "trace: fork failed\n");
+  } else if(pid == 0){
+    close(fd);
+    if(trace(parsemask(argv[i])) < 0){
+      fprintf(2, "trace: trace failed\n");
+      exit(1);
+    }
+    exec(argv[i+1], argv + i + 1);
+    fprintf(2, "trace: exec %s failed\n", argv[i+1]);
+    exit(1);
+  } else {
+    while((w = wait(0)) != pid && w >= 0)
+      ;
   }
-  exec(nargv[0], nargv);
+
+  write(fd, &off, sizeof(off));
+  wait(0);
   exit(0);
-}
\ No newline at end of file
+}
@@ -0,0 +1,131 @@
+//
+// Trap latency microbenchmark: the cost of a null system call,
+// of a page fault, and of a pipe round trip between two processes,
+// in ticks of the time register (100ns each on qemu's virt board).
+//
+// usage: traplat [iterations]
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+static inline uint64
+rdtime(void)
+{
+  uint64 x;
+  asm volatile("rdtime %0" : "=r" (x));
+  return x;
+}
+
+static void
+report(char *what, uint64 t, int n)
+{
+  int hundredths = t * 100 / n;
+
+  printf("%s: %d iterations, %d.%d%d ticks each\n", what, n,
+         hundredths / 100, hundredths / 10 % 10, hundredths % 10);
+}
+
+// a system call that does nothing but enter and leave the kernel.
+void
+nullsyscall(int n)
+{
+  uint64 t0;
+  int i;
+
+  t0 = rdtime();
+  for(i = 0; i < n; i++)
+    getpid();
+  report("null syscall", rdtime() - t0, n);
+}
+
+#ifdef LAB_MMAP
+// a load from each page of fresh anonymous memory.
+void
+pagefault(int n)
+{
+  uint64 t0, t;
+  char *p;
+  int i, done = 0;
+
+  t = 0;
+  while(done < n){
+    int npages = n - done < 256 ? n - done : 256;
+    p = mmap(0, npages*PGSIZE, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == (char*)-1){
+      printf("traplat: mmap failed\n");
+      exit(1);
+    }
+    // one page per fault.
+    madvise(p, npages*PGSIZE, MADV_RANDOM);
+    t0 = rdtime();
+    for(i = 0; i < npages; i++)
+      *(volatile char*)(p + i*PGSIZE);
+    t += rdtime() - t0;
+    munmap(p, npages*PGSIZE);
+    done += npages;
+  }
+  report("page fault", t, n);
+}
+#endif
+
+// a byte to another process and back, two context switches.
+void
+pingpong(int n)
+{
+  int p2c[2], c2p[2];
+  uint64 t0;
+  char c = 0;
+  int i;
+
+  if(pipe(p2c) < 0 || pipe(c2p) < 0){
+    printf("traplat: pipe failed\n");
+    exit(1);
+  }
+  int pid = fork();
+  if(pid < 0){
+    printf("traplat: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < n; i++){
+      if(read(p2c[0], &c, 1) != 1 || write(c2p[1], &c, 1) != 1)
+        break;
+    }
+    exit(0);
+  }
+  t0 = rdtime();
+  for(i = 0; i < n; i++){
+    if(write(p2c[1], &c, 1) != 1 || read(c2p[0], &c, 1) != 1){
+      printf("traplat: pipe round trip failed\n");
+      exit(1);
+    }
+  }
+  report("pipe round trip", rdtime() - t0, n);
+  wait(0);
+  close(p2c[0]);
+  close(p2c[1]);
+  close(c2p[0]);
+  close(c2p[1]);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 10000;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n <= 0){
+    fprintf(2, "usage: traplat [iterations]\n");
+    exit(1);
+  }
+  nullsyscall(n);
+#ifdef LAB_MMAP
+  pagefault(n);
+#endif
+  pingpong(n);
+  exit(0);
+}
@@ -1,8 +1,10 @@
 #include "kernel/types.h"
+#include "kernel/param.h"
 #include "kernel/riscv.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
 #include "kernel/memlayout.h"
+#include "kernel/cpustat.h"
 #include "user/user.h"
 
 //
@@ -148,6 +150,26 @@ memcpy(void *dst, const void *src, uint n)
   return memmove(dst, src, n);
 }
 
+// Add inc to the caller's nice value, within the limits, and
+// return the new one, or -1 on error.
+int
+nice(int inc)
+{
+  struct cpustat st;
+  int n;
+
+  if(cpustat(0, &st) < 0)
+    return -1;
+  n = st.nice + inc;
+  if(n < NICEMIN)
+    n = NICEMIN;
+  if(n > NICEMAX)
+    n = NICEMAX;
+  if(setpriority(0, n) < 0)
+    return -1;
+  return n;
+}
+
 #ifdef LAB_PGTBL
 int
 ugetpid(void)
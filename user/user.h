@@ -1,4 +1,6 @@
 struct stat;
+struct memstat;
+struct cpustat;
 
 // system calls
 int fork(void);
@@ -10,6 +12,15 @@ int read(int, void*, int);
 int close(int);
 int kill(int);
 int exec(const char*, char**);
+int spawn(const char*, char**, int*, int);
+int memstat(int, struct memstat*);
+int clone(void (*)(void*), void*, void*);
+int nanosleep(uint64);
+int setpriority(int, int);
+int cpustat(int, struct cpustat*);
+int setaffinity(int, uint64);
+int futex_wait(volatile uint*, uint, uint64);
+int futex_wake(volatile uint*, int);
 int open(const char*, int);
 int mknod(const char*, short, short);
 int unlink(const char*);
@@ -39,7 +50,8 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
-int trace(int);
+int nice(int);
+int trace(uint64);
 int sysinfo(void*);
 
 int pgaccess(void *base, int len, void *mask);
@@ -60,3 +72,22 @@ int symlink(char *target, char *path);
 
 void *mmap(void *addr, int length, int prot, int flags, int fd, int offset);
 int munmap(void *addr, int length);
+int madvise(void *addr, int length, int advice);
+
+// usync.c: mutexes and condition variables on futexes, which
+// work between processes too if they are in memory both map.
+struct mutex {
+  uint state;     // 0 free, 1 held, 2 held and maybe waited for
+};
+struct cond {
+  uint seq;       // counts signals
+};
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+int mutex_trylock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+int cond_timedwait(struct cond*, struct mutex*, uint64);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
@@ -7,6 +7,11 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/sysinfo.h"
+#include "kernel/memstat.h"
+#include "kernel/prof.h"
+#include "kernel/systrace.h"
+#include "kernel/cpustat.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -535,6 +540,57 @@ opentest(char *s)
   }
 }
 
+// hold more descriptors than the initial per-process table
+// has room for, and check that the lowest free one is reused.
+void
+manyfds(char *s)
+{
+  enum { N=200 };
+  static int fds[N];
+  int i, fd, pid, xstatus;
+
+  for(i = 0; i < N; i++){
+    if((fds[i] = open("echo", 0)) < 0){
+      printf("%s: open #%d failed\n", s, i);
+      exit(1);
+    }
+    if(i > 0 && fds[i] != fds[i-1] + 1){
+      printf("%s: fd %d after %d\n", s, fds[i], fds[i-1]);
+      exit(1);
+    }
+  }
+  close(fds[10]);
+  close(fds[N/2]);
+  if((fd = dup(fds[0])) != fds[10]){
+    printf("%s: dup got %d, wanted %d\n", s, fd, fds[10]);
+    exit(1);
+  }
+  if((fd = dup(fds[0])) != fds[N/2]){
+    printf("%s: dup got %d, wanted %d\n", s, fd, fds[N/2]);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    char c;
+    if(read(fds[N-1], &c, 1) != 1)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child could not read inherited fd %d\n", s, fds[N-1]);
+    exit(1);
+  }
+
+  for(i = 0; i < N; i++)
+    close(fds[i]);
+}
+
 void
 writetest(char *s)
 {
@@ -731,6 +787,57 @@ exectest(char *s)
 
 }
 
+// spawn() a program with its output redirected, without fork().
+void
+spawntest(char *s)
+{
+  int fd, xstatus, pid;
+  char *echoargv[] = { "echo", "OK", 0 };
+  int fds[3] = { 0, -1, 2 };
+  char buf[3];
+
+  unlink("spawn-ok");
+  fd = open("spawn-ok", O_CREATE|O_WRONLY);
+  if(fd < 0) {
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  fds[1] = fd;
+  if((pid = spawn("echo", echoargv, fds, 3)) < 0) {
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if (wait(&xstatus) != pid) {
+    printf("%s: wait failed!\n", s);
+    exit(1);
+  }
+  if(xstatus != 0)
+    exit(xstatus);
+
+  fd = open("spawn-ok", O_RDONLY);
+  if(fd < 0 || read(fd, buf, 2) != 2) {
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("spawn-ok");
+  if(buf[0] != 'O' || buf[1] != 'K') {
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+
+  if(spawn("nonexistent", echoargv, 0, -1) >= 0) {
+    printf("%s: spawn of nonexistent program succeeded\n", s);
+    exit(1);
+  }
+  fds[1] = 100;
+  if(spawn("echo", echoargv, fds, 3) >= 0) {
+    printf("%s: spawn with bad fd succeeded\n", s);
+    exit(1);
+  }
+}
+
 // simple fork and pipe read/write
 
 void
@@ -2264,6 +2371,587 @@ sbrkarg(char *s)
   } 
 }
 
+// sbrk() only reserves memory; reading untouched heap costs no
+// memory, and writing it gets a private zeroed page.
+void
+lazysbrk(char *s)
+{
+  enum { BIG=8*1024*1024 };
+  struct sysinfo before, after;
+  char *a, *p;
+  int n = 0, pid, xstatus;
+
+  if(sysinfo(&before) < 0){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  a = sbrk(BIG);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(p = a; p < a + BIG; p += PGSIZE)
+    n += *p;
+  sysinfo(&after);
+  if(n != 0){
+    printf("%s: untouched heap not zero\n", s);
+    exit(1);
+  }
+  // allow for page-table pages.
+  if(before.freemem - after.freemem > BIG/8){
+    printf("%s: reading heap used %d bytes\n", s, (int)(before.freemem - after.freemem));
+    exit(1);
+  }
+
+  a[PGSIZE] = 1;
+  if(a[0] != 0 || a[2*PGSIZE] != 0 || a[PGSIZE] != 1){
+    printf("%s: write to heap leaked to other pages\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    a[0] = 2;
+    exit(a[PGSIZE] == 1 ? 0 : 1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || a[0] != 0){
+    printf("%s: heap not private after fork\n", s);
+    exit(1);
+  }
+  sbrk(-BIG);
+}
+
+// memstat() counts the pages a process maps as it maps and unmaps
+// them, and a child starts out with its parent's.
+void
+memstattest(char *s)
+{
+  enum { N=64 };
+  struct memstat before, st;
+  char *a;
+  int i, pid, xstatus;
+
+  if(memstat(0, &before) < 0){
+    printf("%s: memstat failed\n", s);
+    exit(1);
+  }
+  if(memstat(getpid(), &st) < 0 || st.rss != before.rss){
+    printf("%s: memstat of own pid differs\n", s);
+    exit(1);
+  }
+  if(memstat(-1, &st) >= 0){
+    printf("%s: memstat of no process succeeded\n", s);
+    exit(1);
+  }
+
+  a = sbrk(N*PGSIZE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    a[i*PGSIZE] = i;
+  memstat(0, &st);
+  if(st.rss + st.swapped < before.rss + N){
+    printf("%s: rss %d, expected at least %d\n", s, (int)st.rss, (int)before.rss + N);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    struct memstat child;
+    memstat(0, &child);
+    exit(child.rss + child.swapped == st.rss + st.swapped ? 0 : 1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child's rss differs from its parent's\n", s);
+    exit(1);
+  }
+
+  sbrk(-N*PGSIZE);
+  memstat(0, &st);
+  if(st.rss + st.swapped != before.rss + before.swapped){
+    printf("%s: rss %d after sbrk, expected %d\n", s, (int)st.rss, (int)before.rss);
+    exit(1);
+  }
+}
+
+// clone() threads share memory and file descriptors, fault pages
+// into the same page table at once, and die with their process.
+#define NCLONE 4
+#define NCLONEPG 64
+
+static char *cloneheap;
+static int clonefd[NCLONE];
+static volatile int nclonedone;
+
+void
+clonechild(void *arg)
+{
+  int i = (int)(uint64)arg, j, fds[2];
+
+  // heap pages, not yet touched, interleaved among the threads.
+  for(j = i; j < NCLONEPG; j += NCLONE)
+    cloneheap[j*PGSIZE] = i + 1;
+  if(pipe(fds) < 0 || write(fds[1], &i, sizeof(i)) != sizeof(i))
+    exit(1);
+  close(fds[1]);
+  clonefd[i] = fds[0];
+  __sync_fetch_and_add(&nclonedone, 1);
+  exit(0);
+}
+
+void
+clonespin(void *arg)
+{
+  for(;;)
+    ;
+}
+
+void
+clonetest(char *s)
+{
+  char *stacks;
+  int i, j, pid, xstatus;
+
+  cloneheap = sbrk(NCLONEPG*PGSIZE);
+  stacks = sbrk(NCLONE*PGSIZE);
+  if(cloneheap == (char*)0xffffffffffffffffL || stacks == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  nclonedone = 0;
+  for(i = 0; i < NCLONE; i++){
+    if(clone(clonechild, (void*)(uint64)i, stacks + (i+1)*PGSIZE) < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < NCLONE; i++){
+    if(wait(&xstatus) < 0 || xstatus != 0){
+      printf("%s: thread failed\n", s);
+      exit(1);
+    }
+  }
+  if(nclonedone != NCLONE){
+    printf("%s: %d threads finished, expected %d\n", s, nclonedone, NCLONE);
+    exit(1);
+  }
+  for(j = 0; j < NCLONEPG; j++){
+    if(cloneheap[j*PGSIZE] != j % NCLONE + 1){
+      printf("%s: page %d has %d, expected %d\n", s, j, cloneheap[j*PGSIZE], j % NCLONE + 1);
+      exit(1);
+    }
+  }
+  // the threads' descriptors are the process's.
+  for(i = 0; i < NCLONE; i++){
+    if(read(clonefd[i], &j, sizeof(j)) != sizeof(j) || j != i){
+      printf("%s: pipe from thread %d\n", s, i);
+      exit(1);
+    }
+    close(clonefd[i]);
+  }
+
+  // a process that exits takes its spinning threads with it.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < NCLONE; i++)
+      clone(clonespin, 0, stacks + (i+1)*PGSIZE);
+    sleep(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: exit with threads failed\n", s);
+    exit(1);
+  }
+  sbrk(-(NCLONEPG+NCLONE)*PGSIZE);
+}
+
+// the lock profile, read from the statistics device, charges
+// spinlock and sleeplock acquisitions to their sites.
+void
+lockstattest(char *s)
+{
+  enum { SZ = 64*1024, N = 100 };
+  char *out, *l, *nl;
+  int fds[2], fd, i, n, spin = 0, sleep = 0;
+
+  if((fd = open("statistics", O_WRONLY)) < 0 || write(fd, "", 1) != 1){
+    printf("%s: cannot clear the lock profile\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    write(fds[1], "x", 1);
+    read(fds[0], buf, 1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  out = sbrk(SZ);
+  n = statistics(out, SZ-1);
+  out[n] = 0;
+  for(l = out; (nl = strchr(l, '\n')) != 0; l = nl + 1){
+    *nl = 0;
+    if(memcmp(l, "lockstat: 0x", 12) != 0)
+      continue;
+    // the name ends the line, after the site and the sleeplock flag.
+    if(nl - l > 5 && strcmp(nl - 5, " pipe") == 0 && l[29] == '0')
+      spin = 1;
+    if(nl - l > 6 && strcmp(nl - 6, " inode") == 0 && l[29] == '1')
+      sleep = 1;
+  }
+  if(!spin || !sleep){
+    printf("%s: no profile for the pipe spinlock or an inode sleeplock\n", s);
+    exit(1);
+  }
+}
+
+// the sampling profiler sees a process spinning in user code.
+void
+proftest(char *s)
+{
+  struct sample sm[16];
+  int fd, i, n, t0, rate = 10, zero = 0, found = 0;
+  volatile int x = 0;
+
+  if((fd = open("prof", O_RDWR)) < 0 || write(fd, &rate, sizeof(rate)) != sizeof(rate)){
+    printf("%s: cannot start the profiler\n", s);
+    exit(1);
+  }
+  t0 = uptime();
+  while(uptime() < t0 + 3)
+    for(i = 0; i < 10000; i++)
+      x++;
+  write(fd, &zero, sizeof(zero));
+  while((n = read(fd, sm, sizeof(sm))) > 0){
+    for(i = 0; i < n / sizeof(sm[0]); i++)
+      if(sm[i].pid == getpid() && sm[i].user)
+        found = 1;
+  }
+  close(fd);
+  if(n < 0 || !found){
+    printf("%s: no samples of this process in user code\n", s);
+    exit(1);
+  }
+}
+
+// traced system calls come back from the systrace device as
+// records, with their arguments, results and times.
+void
+systracetest(char *s)
+{
+  enum { N = 10 };
+  struct sysrec r[16];
+  int fd, i, n, pid, xstatus, on = 1, off = 0, found = 0, foundhigh = 0;
+
+  if((fd = open("systrace", O_RDWR)) < 0 || write(fd, &on, sizeof(on)) != sizeof(on)){
+    printf("%s: cannot turn tracing on\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // a call numbered above 31 needs the whole 64-bit mask.
+    trace((1UL << SYS_getpid) | (1UL << SYS_setpriority));
+    for(i = 0; i < N; i++){
+      getpid();
+      setpriority(0, 0);
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  write(fd, &off, sizeof(off));
+  while((n = read(fd, r, sizeof(r))) > 0){
+    for(i = 0; i < n / sizeof(r[0]); i++){
+      if(r[i].pid != pid)
+        continue;
+      if(r[i].exit < r[i].entry ||
+         !((r[i].num == SYS_getpid && r[i].ret == pid) ||
+           (r[i].num == SYS_setpriority && r[i].ret == 0))){
+        printf("%s: bad record for syscall %d\n", s, r[i].num);
+        exit(1);
+      }
+      if(r[i].num == SYS_getpid)
+        found++;
+      else
+        foundhigh++;
+    }
+  }
+  close(fd);
+  if(xstatus != 0 || n < 0 || found != N || foundhigh != N){
+    printf("%s: %d records of %d getpid() calls, %d of setpriority()\n",
+           s, found, N, foundhigh);
+    exit(1);
+  }
+}
+
+// nanosleep() sleeps for at least as long as asked, and not
+// until the next clock tick.
+void
+nanosleeptest(char *s)
+{
+  enum { N = 10, NS = 1000000 };
+  uint64 t0, t;
+  int i;
+
+  t0 = r_time();
+  for(i = 0; i < N; i++){
+    if(nanosleep(NS) < 0){
+      printf("%s: nanosleep failed\n", s);
+      exit(1);
+    }
+  }
+  t = r_time() - t0;
+  if(t < N * NS / NSPERTIME){
+    printf("%s: %d nanosleep(%d) took %d ns\n", s, N, NS, (int)(t * NSPERTIME));
+    exit(1);
+  }
+  // each one would take a tick if they waited for ticks.
+  if(t >= N * TICKINTERVAL / 2){
+    printf("%s: %d nanosleep(%d) took %d ticks\n", s, N, NS, (int)(t / TICKINTERVAL));
+    exit(1);
+  }
+}
+
+// nice values are kept in range and inherited, and the kernel
+// counts each process's CPU time and context switches.
+void
+nicetest(char *s)
+{
+  struct cpustat st, st1;
+  int pid, xstatus, t0;
+  volatile int x = 0;
+
+  if(setpriority(0, NICEMAX + 1) == 0 || setpriority(0, 5) < 0){
+    printf("%s: setpriority range\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(cpustat(0, &st) < 0 || st.nice != 5)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child did not inherit nice 5\n", s);
+    exit(1);
+  }
+  if(nice(-5) != 0){
+    printf("%s: nice(-5) did not give 0\n", s);
+    exit(1);
+  }
+
+  cpustat(0, &st);
+  t0 = uptime();
+  while(uptime() < t0 + 2)
+    x++;
+  sleep(1);
+  cpustat(0, &st1);
+  if(st1.utime <= st.utime || st1.vruntime <= st.vruntime || st1.nvcsw <= st.nvcsw){
+    printf("%s: no CPU time or context switches counted\n", s);
+    exit(1);
+  }
+}
+
+// a process pinned to a hart runs only there, and its children
+// inherit the pin.
+void
+affinitytest(char *s)
+{
+  struct cpustat st;
+  int i, pid, xstatus, t0;
+
+  if(setaffinity(0, 0) == 0){
+    printf("%s: setaffinity with no harts succeeded\n", s);
+    exit(1);
+  }
+  if(setaffinity(0, 1) < 0){
+    printf("%s: setaffinity to hart 0 failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // preempted every tick, and each time back on hart 0.
+    for(i = 0; i < 4; i++){
+      t0 = uptime();
+      while(uptime() == t0)
+        ;
+      if(cpustat(0, &st) < 0 || st.cpumask != 1 || st.lastcpu != 0)
+        exit(1);
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(setaffinity(0, ~0L) < 0){
+    printf("%s: could not unpin\n", s);
+    exit(1);
+  }
+  if(xstatus != 0){
+    printf("%s: pinned child ran on another hart\n", s);
+    exit(1);
+  }
+}
+
+// futex_wait() returns at once if the word has changed, and times
+// out; mutexes and condition variables built on futexes work
+// between processes sharing a MAP_SHARED page.
+void
+futextest(char *s)
+{
+  enum { N = 1000 };
+  struct shared {
+    struct mutex m;
+    struct cond c;
+    int count, done;
+  } *sh;
+  uint word = 1;
+  uint64 t0;
+  int i, pid, xstatus;
+
+  if(futex_wait(&word, 0, 0) != 0){
+    printf("%s: futex_wait slept on a changed word\n", s);
+    exit(1);
+  }
+  t0 = r_time();
+  if(futex_wait(&word, 1, 10000000) != 1 || r_time() - t0 < 10000000 / NSPERTIME){
+    printf("%s: futex_wait did not time out after 10ms\n", s);
+    exit(1);
+  }
+  if(futex_wake(&word, 1) != 0){
+    printf("%s: futex_wake woke a waiter that is not there\n", s);
+    exit(1);
+  }
+
+  sh = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(sh == (void*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  mutex_init(&sh->m);
+  cond_init(&sh->c);
+  sh->count = sh->done = 0;
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < N; i++){
+      mutex_lock(&sh->m);
+      sh->count++;
+      mutex_unlock(&sh->m);
+    }
+    mutex_lock(&sh->m);
+    sh->done = 1;
+    cond_signal(&sh->c);
+    mutex_unlock(&sh->m);
+    exit(0);
+  }
+  for(i = 0; i < N; i++){
+    mutex_lock(&sh->m);
+    sh->count++;
+    mutex_unlock(&sh->m);
+  }
+  mutex_lock(&sh->m);
+  while(!sh->done)
+    cond_wait(&sh->c, &sh->m);
+  mutex_unlock(&sh->m);
+  wait(&xstatus);
+  if(xstatus != 0 || sh->count != 2*N){
+    printf("%s: count %d, not %d\n", s, sh->count, 2*N);
+    exit(1);
+  }
+  munmap(sh, PGSIZE);
+}
+
+// fork() shares the page-table pages of a big heap with the child
+// instead of copying them; parent, child and grandchild must each
+// still see their own writes and nobody else's.
+void
+forkbigheap(char *s)
+{
+  enum { BIG=6*1024*1024 };
+  struct sysinfo before, after;
+  char *a;
+  int i, pid, xstatus;
+
+  a = sbrk(BIG);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < BIG; i += PGSIZE)
+    a[i] = i / PGSIZE;
+
+  sysinfo(&before);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sysinfo(&after);
+    // a leaf table per 2MB, not a page per page.
+    if(before.freemem - after.freemem > 64*PGSIZE)
+      exit(2);
+    for(i = 0; i < BIG; i += PGSIZE)
+      if(a[i] != (char)(i / PGSIZE))
+        exit(3);
+    a[BIG/2] = 'c';
+    pid = fork();
+    if(pid == 0){
+      a[BIG/2 + PGSIZE] = 'g';
+      exit(a[BIG/2] == 'c' ? 0 : 4);
+    }
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+    exit(a[BIG/2 + PGSIZE] == (char)(BIG/2/PGSIZE + 1) ? 0 : 5);
+  }
+  a[0] = 'p';
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child failed with %d\n", s, xstatus);
+    exit(1);
+  }
+  if(a[0] != 'p' || a[BIG/2] != (char)(BIG/2/PGSIZE)){
+    printf("%s: heap not private after fork\n", s);
+    exit(1);
+  }
+  sbrk(-BIG);
+}
+
 void
 validatetest(char *s)
 {
@@ -2589,11 +3277,13 @@ struct test {
   {exitiputtest, "exitiput"},
   {iputtest, "iput"},
   {opentest, "opentest"},
+  {manyfds, "manyfds"},
   {writetest, "writetest"},
   {writebig, "writebig"},
   {createtest, "createtest"},
   {dirtest, "dirtest"},
   {exectest, "exectest"},
+  {spawntest, "spawntest"},
   {pipe1, "pipe1"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
@@ -2625,6 +3315,17 @@ struct test {
   {MAXVAplus, "MAXVAplus"},
   {sbrkfail, "sbrkfail"},
   {sbrkarg, "sbrkarg"},
+  {lazysbrk, "lazysbrk"},
+  {forkbigheap, "forkbigheap"},
+  {memstattest, "memstattest"},
+  {clonetest, "clonetest"},
+  {lockstattest, "lockstattest"},
+  {proftest, "proftest"},
+  {systracetest, "systracetest"},
+  {nanosleeptest, "nanosleeptest"},
+  {nicetest, "nicetest"},
+  {affinitytest, "affinitytest"},
+  {futextest, "futextest"},
   {validatetest, "validatetest"},
   {bsstest, "bsstest"},
   {bigargtest, "bigargtest"},
@@ -2925,6 +3626,155 @@ outofinodes(char *s)
   }
 }
 
+// use more memory than there is, so that pages go out to swap
+// and come back, and check that every page kept its contents.
+void
+swaptest(char *s)
+{
+  enum { EXTRA=2*1024*1024 };
+  struct sysinfo info;
+  uint64 n, i;
+  char *a;
+  int pid, xstatus;
+
+  sysinfo(&info);
+  n = info.freemem + EXTRA;
+  a = sbrk(n);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk(%d) failed, no swap space?\n", s, (int)n);
+    exit(1);
+  }
+  for(i = 0; i < n; i += PGSIZE)
+    *(uint64*)(a + i) = i;
+
+  // a child shares the swapped-out pages.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // only a few pages: memory is full, and the child's
+    // page tables and swapped-in pages take some.
+    for(i = 0; i < n; i += PGROUNDUP(n / 8))
+      if(*(uint64*)(a + i) != i)
+        exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child read wrong data\n", s);
+    exit(1);
+  }
+
+  for(i = 0; i < n; i += PGSIZE){
+    if(*(uint64*)(a + i) != i){
+      printf("%s: page at %p lost its contents\n", s, a + i);
+      exit(1);
+    }
+  }
+  sbrk(-n);
+}
+
+// pages used just before a sleep are in the working set that the
+// kernel's sampler reports; after a longer sleep they have aged
+// out of it, into the older buckets of the histogram.
+void
+wsstest(char *s)
+{
+  enum { N=64 };
+  struct memstat st;
+  char *a;
+  int i, old;
+
+  a = sbrk(N*PGSIZE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    a[i*PGSIZE] = i;
+
+  // a few sampling periods, of 10 ticks each.
+  sleep(25);
+  memstat(0, &st);
+  if(st.wss < N){
+    printf("%s: wss %d after touching %d pages\n", s, (int)st.wss, N);
+    exit(1);
+  }
+
+  // long enough that they are older than the 4-period window.
+  sleep(70);
+  memstat(0, &st);
+  old = 0;
+  for(i = 3; i < NWSSHIST; i++)
+    old += st.hist[i];
+  if(old < N){
+    printf("%s: %d old pages, expected at least %d\n", s, old, N);
+    exit(1);
+  }
+  sbrk(-N*PGSIZE);
+}
+
+// several processes read the same file, and look up its name in
+// the same directory, at once. They share the inodes' locks, so
+// this should take about as long as one of them alone.
+void
+sharedread(char *s)
+{
+  enum { NCHILD = 4, NPASS = 50, SZ = 16*1024 };
+  int fd, i, j, n, pid, xstatus, t0, t1;
+  char *data;
+
+  data = sbrk(SZ);
+  for(i = 0; i < SZ; i++)
+    data[i] = 'a' + i % 23;
+  unlink("sharedread");
+  fd = open("sharedread", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, data, SZ) != SZ){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  for(n = 1; n <= NCHILD; n *= NCHILD){
+    t0 = uptime();
+    for(i = 0; i < n; i++){
+      pid = fork();
+      if(pid < 0){
+        printf("%s: fork failed\n", s);
+        exit(1);
+      }
+      if(pid == 0){
+        for(j = 0; j < NPASS; j++){
+          if((fd = open("sharedread", O_RDONLY)) < 0){
+            printf("%s: open failed\n", s);
+            exit(1);
+          }
+          if(read(fd, data, SZ) != SZ){
+            printf("%s: read failed\n", s);
+            exit(1);
+          }
+          close(fd);
+          if(data[SZ-1] != 'a' + (SZ-1) % 23){
+            printf("%s: wrong data\n", s);
+            exit(1);
+          }
+        }
+        exit(0);
+      }
+    }
+    for(i = 0; i < n; i++){
+      wait(&xstatus);
+      if(xstatus != 0)
+        exit(1);
+    }
+    t1 = uptime();
+    printf("%d readers: %d ticks; ", n, t1 - t0);
+  }
+  unlink("sharedread");
+}
+
 struct test slowtests[] = {
   {bigdir, "bigdir"},
   {manywrites, "manywrites"},
@@ -2932,6 +3782,9 @@ struct test slowtests[] = {
   {execout, "execout"},
   {diskfull, "diskfull"},
   {outofinodes, "outofinodes"},
+  {swaptest, "swaptest"},
+  {wsstest, "wsstest"},
+  {sharedread, "sharedread"},
     
   { 0, 0},
 };
@@ -0,0 +1,117 @@
+//
+// Mutexes and condition variables, on futex_wait() and
+// futex_wake(). A mutex is taken with one atomic instruction when
+// nobody holds it, and only goes into the kernel to sleep when
+// somebody does, or to wake a waiter when there might be one; see
+// Drepper, "Futexes Are Tricky".
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+static uint
+cas(volatile uint *p, uint old, uint new)
+{
+  __atomic_compare_exchange_n(p, &old, new, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+  return old;
+}
+
+static uint
+xchg(volatile uint *p, uint new)
+{
+  return __atomic_exchange_n(p, new, __ATOMIC_ACQUIRE);
+}
+
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  uint c;
+
+  if((c = cas(&m->state, 0, 1)) == 0)
+    return;
+  // say there is a waiter, and sleep until it is free.
+  if(c != 2)
+    c = xchg(&m->state, 2);
+  while(c != 0){
+    futex_wait(&m->state, 2, 0);
+    c = xchg(&m->state, 2);
+  }
+}
+
+// Returns 1 if it took m, 0 if m was held.
+int
+mutex_trylock(struct mutex *m)
+{
+  return cas(&m->state, 0, 1) == 0;
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__atomic_fetch_sub(&m->state, 1, __ATOMIC_RELEASE) != 1){
+    // there may be waiters.
+    __atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+    futex_wake(&m->state, 1);
+  }
+}
+
+// Take m after waiting on a condition: others may have been woken
+// with us, so m is marked as waited for.
+static void
+relock(struct mutex *m)
+{
+  while(xchg(&m->state, 2) != 0)
+    futex_wait(&m->state, 2, 0);
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+// Release m, wait to be signalled, and take m again. As with any
+// condition variable, the caller must check its condition again.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  uint seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq, 0);
+  relock(m);
+}
+
+// cond_wait() for at most ns nanoseconds. Returns 1 if the time
+// ran out first, 0 otherwise.
+int
+cond_timedwait(struct cond *c, struct mutex *m, uint64 ns)
+{
+  uint seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+  int r;
+
+  mutex_unlock(m);
+  r = futex_wait(&c->seq, seq, ns);
+  relock(m);
+  return r == 1;
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+  futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+  futex_wake(&c->seq, 0x7fffffff);
+}
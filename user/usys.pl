@@ -44,4 +44,14 @@ entry("sigreturn");
 entry("connect");
 entry("symlink");
 entry("mmap");
-entry("munmap");
\ No newline at end of file
+entry("munmap");
+entry("madvise");
+entry("spawn");
+entry("memstat");
+entry("clone");
+entry("nanosleep");
+entry("setpriority");
+entry("cpustat");
+entry("setaffinity");
+entry("futex_wait");
+entry("futex_wake");